@@ -19,7 +19,6 @@
 volatile plic_t *const plic = (volatile plic_t *)PLIC_BASE_ADDR;
 
 static plic_instance_t plic_instance[PLIC_NUM_CORES][IRQN_MAX];
-extern trap_info_t trap_info;
 
 void plic_init(void)
 {
@@ -13,6 +13,8 @@ static struct task_struct *buffer_wait = NULL;
 
 int NR_BUFFERS = 0;
 
+#define READAHEAD_MAX 32//blocks per call,more would push the prefetched blocks out of the cache again
+
 static inline void wait_on_buffer(struct buffer_head *bh)
 {
     sysctl_disable_irq();
@@ -436,6 +438,68 @@ struct buffer_head *breada(int dev,int first,...)
     return NULL;
 }
 
+//Start reading count blocks of inode from block on without waiting for them,like the tail of breada().
+//Holes and blocks past the end of file are skipped
+void inode_readahead(struct m_inode *inode,ulong block,ulong count)
+{
+    struct buffer_head *bh;
+    ulong end = (inode -> i_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    int nr;
+
+    count = (count > READAHEAD_MAX) ? READAHEAD_MAX : count;
+    end = (block + count < end) ? block + count : end;
+
+    for(;block < end;block++)
+    {
+        if((nr = bmap(inode,block)) && (bh = getblk(inode -> i_dev,nr)))
+        {
+            if(!bh -> b_uptodate)
+            {
+                ll_rw_block(READA,bh);
+            }
+
+            bh -> b_count--;
+        }
+    }
+}
+
+//Move the clean,unused buffers of count blocks of inode from block on to the head of the free list,
+//so that getblk() reuses them before anything else
+void inode_drop_buffers(struct m_inode *inode,ulong block,ulong count)
+{
+    struct buffer_head *bh;
+    ulong end = (inode -> i_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    int nr;
+
+    end = (block + count < end) ? block + count : end;
+
+    for(;block < end;block++)
+    {
+        if((!(nr = bmap(inode,block))) || (!(bh = find_buffer(inode -> i_dev,nr))))
+        {
+            continue;
+        }
+
+        if(bh -> b_count || bh -> b_dirt || bh -> b_lock)
+        {
+            continue;
+        }
+
+        remove_from_queues(bh);
+        bh -> b_uptodate = 0;
+        insert_into_queues(bh);
+        free_list = bh;
+    }
+}
+
+//True if the buffer cache has changes to block the device hasn't seen yet
+bool buffer_dirty(int dev,int block)
+{
+    struct buffer_head *bh = find_buffer(dev,block);
+
+    return bh && (bh -> b_dirt || bh -> b_lock);
+}
+
 void buffer_init(ulong buffer_end)
 {
     struct buffer_head *h = start_buffer;
@@ -11,8 +11,6 @@
 extern ulong sys_exit(int exit_code);
 extern ulong sys_close(int fd);
 
-extern trap_info_t trap_info;
-
 //MAX_ARG_PAGES defines the number of pages allocated for arguments and envelope for the new program
 //32 should suffice,this gives a maximum env + arg of 128kB!
 
@@ -406,13 +404,24 @@ int do_execve(char *filename,char **argv,char **envp)
         }
         
         current -> close_on_exec = 0;
-        free_page_tables(current -> code_base,current -> page_dir_table,current -> code_limit);
-        free_page_tables(current -> data_base,current -> page_dir_table,current -> data_limit);
+        current -> mlock = 0;
+        vfork_release();
+        tlb_batch_start();
+
+        if(!exit_mmap())
+        {
+            defer_page_tables(current -> code_base,current -> page_dir_table,current -> code_limit);
+            defer_page_tables(current -> data_base,current -> page_dir_table,current -> data_limit);
+        }
+
+        tlb_batch_end();
+
         p += change_ldt(ex.a_text,page) - MAX_ARG_PAGES * PAGE_SIZE;
         p = (ulong)create_tables((char *)p,argc,envc);
         current -> start_code = 0xC0000000;
         current -> brk = ex.a_bss + (current -> end_data = ex.a_data + (current -> end_code = 0xC0000000 + ex.a_text));
         current -> start_stack = p & 0xFFFFF000;
+        setup_exec_vmas(inode);
         current -> euid = e_uid;
         current -> egid = e_gid;
         /*i = 0xC0000000 + ex.a_text + ex.a_data;
@@ -421,7 +430,8 @@ int do_execve(char *filename,char **argv,char **envp)
         {
             put_fs_byte(0,(uint8_t *)(i++));
         }*/
-        pte_common_disable_user((volatile pte_64model *)&page_root_table[2]);
+        pte_common_disable_user((volatile pte_64model *)&current -> page_root[2]);
+        flush_tlb_all();
         trap_info.regs[reg_sp] = p;
         trap_info.newepc = ex.a_entry;
         //syslog_print("newepc = %p\r\n",trap_info.newepc);
@@ -15,6 +15,8 @@
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #define MAX(a,b) (((a)>(b))?(a):(b))
 
+#define SEQ_READAHEAD 8		/* blocks beyond a POSIX_FADV_SEQUENTIAL read */
+
 int file_read(struct m_inode * inode, struct file * filp, char * buf, int count)
 {
 	int left,chars,nr;
@@ -22,6 +24,9 @@ int file_read(struct m_inode * inode, struct file * filp, char * buf, int count)
 
 	if ((left=count)<=0)
 		return 0;
+	if (filp->f_advice == POSIX_FADV_SEQUENTIAL)
+		inode_readahead(inode,filp->f_pos/BLOCK_SIZE,
+			(count+BLOCK_SIZE-1)/BLOCK_SIZE+SEQ_READAHEAD);
 	while (left) {
 		if (nr = bmap(inode,(filp->f_pos)/BLOCK_SIZE)) {
 			if (!(bh=bread(inode->i_dev,nr)))
@@ -58,6 +63,9 @@ int file_write(struct m_inode * inode, struct file * filp, char * buf, int count
  * ok, append may not work when many processes are writing at the same time
  * but so what. That way leads to madness anyway.
  */
+	if (rd_xip_busy(inode))
+		return -ETXTBSY;
+	text_cache_invalidate(inode);
 	if (filp->f_flags & O_APPEND)
 		pos = inode->i_size;
 	else
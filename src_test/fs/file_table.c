@@ -1,4 +1,38 @@
 #include "common.h"
 #include "linux/fs.h"
+#include "linux/mm.h"
+#include "linux/kernel.h"
 
-struct file file_table[NR_FILE];
\ No newline at end of file
+//Open file structures are allocated on demand,NR_FILE still limits how many can be open at once
+static struct kmem_cache *file_cachep;
+static int nr_files = 0;
+
+void file_table_init()
+{
+    if(!(file_cachep = kmem_cache_create("file",sizeof(struct file),NULL)))
+    {
+        panic("file_table_init:can't create file cache");
+    }
+}
+
+//Returns a zeroed file with f_count = 1,or NULL
+struct file *get_empty_filp()
+{
+    struct file *f;
+
+    if((nr_files >= NR_FILE) || !(f = (struct file *)kmem_cache_alloc(file_cachep)))
+    {
+        return NULL;
+    }
+
+    nr_files++;
+    memset(f,0,sizeof(struct file));
+    f -> f_count = 1;
+    return f;
+}
+
+void put_filp(struct file *f)
+{
+    nr_files--;
+    kmem_cache_free(file_cachep,f);
+}
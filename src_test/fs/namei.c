@@ -487,6 +487,12 @@ int open_namei(const char *pathname,int flag,int mode,struct m_inode **res_inode
         return -EPERM;
     }
 
+    if((flag & (O_ACCMODE | O_TRUNC)) && rd_xip_busy(inode))
+    {
+        iput(inode);
+        return -ETXTBSY;
+    }
+
     inode -> i_atime = CURRENT_TIME;
 
     if(flag & O_TRUNC)
@@ -894,6 +900,14 @@ int64_t sys_unlink(const char *name)
         return -EPERM;
     }
 
+    if(rd_xip_busy(inode))
+    {
+        iput(inode);
+        iput(dir);
+        brelse(bh);
+        return -ETXTBSY;
+    }
+
     if(!inode -> i_nlinks)
     {
         printk("Deleteing nonexistent file (%04x:%d), %d\r\n",inode -> i_dev,inode -> i_num,inode -> i_nlinks);
@@ -906,6 +920,13 @@ int64_t sys_unlink(const char *name)
     inode -> i_nlinks--;
     inode -> i_dirt = 1;
     inode -> i_ctime = CURRENT_TIME;
+
+    //a cached text would keep the last link's blocks allocated
+    if(!inode -> i_nlinks)
+    {
+        text_cache_invalidate(inode);
+    }
+
     iput(inode);
     iput(dir);
     return 0;
@@ -280,6 +280,8 @@ int64_t sys_umount(char *dev_name)
         printk("Mounted inode has i_mount = 0\r\n");
     }
 
+    text_cache_invalidate_dev(dev);
+
     for(inode = inode_table + 0;inode < inode_table + NR_INODE;inode++)
     {
         if((inode -> i_dev == dev) && (inode -> i_count))
@@ -370,10 +372,7 @@ void mount_root()
         panic("bad i-node size");
     }
 
-    for(i = 0;i < NR_FILE;i++)
-    {
-        file_table[i].f_count = 0; 
-    }
+    file_table_init();
 
     for(p = &super_block[0];p < &super_block[NR_SUPER];p++)
     {
@@ -69,6 +69,8 @@ void truncate(struct m_inode *inode)
         return;
     }
 
+    text_cache_invalidate(inode);
+
     for(i = 0;i < 7;i++)
     {
         if(inode -> i_zone[i])
@@ -39,6 +39,14 @@
 #define F_WRLCK		1
 #define F_UNLCK		2
 
+/* posix_fadvise() hints, NOREUSE is accepted and ignored */
+#define POSIX_FADV_NORMAL	0
+#define POSIX_FADV_RANDOM	1
+#define POSIX_FADV_SEQUENTIAL	2
+#define POSIX_FADV_WILLNEED	3
+#define POSIX_FADV_DONTNEED	4
+#define POSIX_FADV_NOREUSE	5
+
 /* Once again - not implemented, but ... */
 struct flock {
 	short l_type;
@@ -51,5 +59,6 @@ struct flock {
 extern int creat(const char * filename,mode_t mode);
 extern int fcntl(int fildes,int cmd, ...);
 extern int open(const char * filename, int flags, ...);
+extern int posix_fadvise(int fd, off_t offset, off_t len, int advice);
 
 #endif
\ No newline at end of file
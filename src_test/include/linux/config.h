@@ -45,4 +45,25 @@
  leave HD_TYPE undefined. This is the normal thing to do.
 */
 
+/*
+ * Give the 2MB AI SRAM at 0x80600000 to the page allocator as an extra
+ * zone. Leave it undefined if the KPU is going to use its memory.
+ */
+#define CONFIG_AI_SRAM_ZONE
+
+/*
+ * Map text pages of executables on the ramdisk straight from the
+ * ramdisk instead of copying them. Only pages whose four blocks lie
+ * in order on one page qualify, tools_src/xipalign lays the files
+ * of the root image out like that. An executable on the ramdisk
+ * can't be written, truncated or unlinked while it runs (ETXTBSY).
+ */
+#define CONFIG_RAMDISK_XIP
+
+/*
+ * Run tasks on core 1 as well, both cores share the kernel under one
+ * lock. Without ASIDs each core has a root table of its own.
+ */
+#define CONFIG_SMP
+
 #endif
@@ -114,6 +114,7 @@
 	    uint8_t i_mount;
 	    uint8_t i_seek;
 	    uint8_t i_update;
+	    uint32_t i_text_gen;//bumped by text_cache_invalidate()
     };
 
     struct file 
@@ -123,6 +124,7 @@
 	    uint16_t f_count;
 	    struct m_inode * f_inode;
 	    off_t f_pos;
+	    uint16_t f_advice;//POSIX_FADV_*,steers read-ahead in file_read()
     };
 
     struct super_block 
@@ -167,7 +169,6 @@
     };
 
     extern struct m_inode inode_table[NR_INODE];
-    extern struct file file_table[NR_FILE];
     extern struct super_block super_block[NR_SUPER];
     extern struct buffer_head * start_buffer;
     extern int nr_buffers;
@@ -190,7 +191,12 @@
     extern void brelse(struct buffer_head * buf);
     extern struct buffer_head * bread(int dev,int block);
     extern void bread_page(unsigned long addr,int dev,int b[4]);
+    extern bool buffer_dirty(int dev,int block);
+    extern ulong rd_xip_page(int dev,int b[4]);
+    extern bool rd_xip_busy(struct m_inode * inode);
     extern struct buffer_head * breada(int dev,int block,...);
+    extern void inode_readahead(struct m_inode * inode,ulong block,ulong count);
+    extern void inode_drop_buffers(struct m_inode * inode,ulong block,ulong count);
     extern int new_block(int dev);
     extern void free_block(int dev, int block);
     extern struct m_inode * new_inode(int dev);
@@ -200,5 +206,8 @@
     extern int ROOT_DEV;
 
     extern void mount_root(void);
+    extern void file_table_init(void);
+    extern struct file * get_empty_filp(void);
+    extern void put_filp(struct file * f);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,14 @@
+#ifndef __KSTACK_H__
+#define __KSTACK_H__
+
+    //Only defines,kernel/sched_call.S includes this as well
+    //The lowest KERNEL_STACK_GUARD_SIZE bytes of a kernel stack are filled with KERNEL_STACK_MAGIC and must never be touched,
+    //switch_to_tss() checks the depth of the stack against KERNEL_STACK_LIMIT
+    #ifndef KERNEL_STACK_SIZE
+        #define KERNEL_STACK_SIZE 8192
+    #endif
+
+    #define KERNEL_STACK_GUARD_SIZE 1024
+    #define KERNEL_STACK_LIMIT (KERNEL_STACK_SIZE - KERNEL_STACK_GUARD_SIZE)
+
+#endif
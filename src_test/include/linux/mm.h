@@ -17,19 +17,198 @@
 
     #define USER_START_ADDR 0xC0000000UL
     #define USER_END_ADDR (USER_START_ADDR + PAGE_DIR_TABLE_NUM * PAGE_TABLE_ITEM_NUM * PAGE_SIZE - 1UL)
+    #define MMAP_BASE (USER_START_ADDR + 0x4000000UL)//file mappings live above data_limit
+    #define MMAP_END (USER_START_ADDR + (PAGE_TABLE_ITEM_NUM << PAGING_HIGH_LEVEL_SHIFT))
+
+    #define PTE_IS_SWAP(pte) ((!(pte) -> v) && ((pte) -> rsw & PTE_RSW_SWAP))
+
+    //physical memory zones,all of them lie inside the range mem_map covers
+    #define ZONE_NORMAL 0//general SRAM from mem_init()
+    #define ZONE_AI 1//the 2MB KPU SRAM,only if mem_add_zone() gave it to the allocator at boot
+    #define NR_ZONES 2
+    #define ZONE_MASK(zone) (1UL << (zone))
+    #define ZONES_ALL (ZONE_MASK(ZONE_NORMAL) | ZONE_MASK(ZONE_AI))
+
+    struct swap_stat
+    {
+        ulong out;//pages compressed
+        ulong in;//pages decompressed
+        ulong rejected;//pages which didn't compress well enough
+        ulong same_pages;//resident same-filled slots
+        ulong stored_bytes;//resident compressed bytes
+        ulong pool_pages;
+        ulong in_cycles;//total swap-in latency
+        ulong in_cycles_max;
+        ulong dropped;//clean file pages given up,they fault back in from the file
+    };
+
+    extern struct swap_stat swap_stat;
+
+    struct megapage_stat
+    {
+        ulong mapped;
+        ulong split;//broken into 4KB entries by a write fault after fork
+        ulong failed;//no free 2MB aligned block
+    };
+
+    extern bool megapage_enable;
+    extern struct megapage_stat megapage_stat;
+
+    struct pgtable_stat
+    {
+        ulong shared;//page tables shared by fork
+        ulong unshared;//copied on a write fault
+    };
+
+    extern bool pgtable_share_enable;
+    extern struct pgtable_stat pgtable_stat;
+
+    struct tlb_stat
+    {
+        ulong page;//sfence.vm of one address
+        ulong all;//full sfence.vm
+        ulong batched;//flushes folded into the one at the end of a batch
+        ulong switches;//context switches without a flush
+        ulong rollovers;//ASID generations used up
+    };
+
+    extern struct tlb_stat tlb_stat;
+
+    struct defer_stat
+    {
+        ulong deferred;//directory entries queued by exit and exec
+        ulong drained;//of those,freed by the idle task or reclaim
+        ulong direct;//freed at once because the queue was full or missing
+    };
+
+    extern struct defer_stat defer_stat;
+
+    #define DEFER_DRAIN_BATCH 4//directory entries the idle task frees per pass
+
+    int defer_page_tables(ulong from,volatile pte_sv39 *dir,ulong size);
+    ulong drain_deferred_tables(ulong max);
+    ulong deferred_tables_pending();
+    extern ulong asid_bits;
+
+    void flush_tlb_page(ulong address);
+    void flush_tlb_range(ulong start,ulong size);
+    void flush_tlb_all();
+    void tlb_shootdown_answer();
+    void tlb_lazy_flush();
+    void zero_pool_refill();
+    void tlb_batch_start();
+    void tlb_batch_end();
+    void tlb_batch_flush();
+    struct task_struct;
+    void asid_init();
+    void switch_mm(struct task_struct *p);
+    void flush_tlb_all_tasks();
+    void flush_tlb_task_page(struct task_struct *p,ulong table,ulong address);
+
+    struct zero_page_stat
+    {
+        ulong mapped;//read faults on anonymous memory
+        ulong copied;//write faults which replaced it with a private page
+    };
+
+    extern struct zero_page_stat zero_page_stat;
 
     extern ulong get_free_page(void);
     extern ulong get_free_pages(ulong pagenum);
+    extern ulong get_zone_page(ulong zones);
+    extern ulong get_zone_pages(ulong zones,ulong pagenum);
+    extern void mem_add_zone(int zone,ulong start_mem,ulong end_mem);
     extern ulong put_page(ulong page,ulong address);
     extern void free_page(ulong addr);
     extern void free_pages(ulong addr,ulong pagenum);
     bool user_addr_to_kernel(ulong *addr);
     bool user_ptr_to_kernel(void **ptr);
     bool user_addr_to_kernel_write(ulong *addr);
-    void page_transform_start();
-    bool page_transform_addr(ulong *addr);
-    bool page_transform_ptr(void **ptr);
     void mem_copy_from_kernel(ulong fromaddr,ulong toaddr,ulong size);
     void mem_copy_to_kernel(ulong fromaddr,ulong toaddr,ulong size);
+    ulong page_count(ulong addr);
+    void get_page(ulong addr);
+    volatile pte_sv39 *get_page_entry(ulong address);
+    void zap_page_range(ulong from,ulong size);
+    void make_pages_present(ulong start,ulong end,bool write);
+    bool page_mapped(ulong address);
+    void do_no_page(ulong address,bool write);
+
+    //virtual memory areas,a sorted list per task set up by exec
+    #define VM_READ 0x1//same values as PROT_*
+    #define VM_WRITE 0x2
+    #define VM_EXEC 0x4
+    #define VM_GROWSDOWN 0x100
+    #define VM_SEQ_READ 0x200//madvise() hints
+    #define VM_RAND_READ 0x400
+
+    #define VMA_TEXT 0//from the executable
+    #define VMA_DATA 1//from the executable
+    #define VMA_HEAP 2//anonymous,up to brk
+    #define VMA_STACK 3//anonymous,grows down
+    #define VMA_FILE 4//mmap()
+
+    struct m_inode;
+
+    struct vm_area_struct
+    {
+        ulong vm_start,vm_end;
+        ulong vm_flags;
+        int vm_type;
+        struct m_inode *vm_inode;
+        ulong vm_offset;//file offset of vm_start
+        struct vm_area_struct *vm_next;
+    };
+
+    void vma_init();
+    struct vm_area_struct *find_vma(ulong address);
+    struct vm_area_struct *expand_stack(ulong address);
+    bool vma_file_backed(struct task_struct *p,ulong address);
+    void do_file_page(struct vm_area_struct *vma,ulong address);
+    void setup_exec_vmas(struct m_inode *inode);
+    int dup_mmap(struct task_struct *p);
+    bool exit_mmap();
+    bool vma_set_brk(ulong brk);
+    void show_vma();
+    volatile void oom();
+    void calc_mem();
+
+    ulong lz_compress_page(const uint8_t *in,uint8_t *out,ulong limit);
+    bool lz_decompress_page(const uint8_t *in,ulong size,uint8_t *out);
+    int swap_out();
+    ulong swap_out_task(struct task_struct *p);
+    int drop_clean_page();
+    bool swap_in(ulong address);
+    void swap_free(ulong slot);
+    void swap_duplicate(ulong slot);
+    void show_swap();
+
+    struct kmem_cache;
+    struct kmem_cache *kmem_cache_create(const char *name,ulong size,void (*ctor)(void *));
+    void *kmem_cache_alloc(struct kmem_cache *cachep);
+    void kmem_cache_free(struct kmem_cache *cachep,void *objp);
+    ulong kmem_cache_reap();
+    void kmem_cache_init();
+    void *kmalloc(ulong size);
+    void kfree(void *objp);
+    void show_slab();
+
+    struct text_cache_stat
+    {
+        ulong hits;//text faults mapped from the cache
+        ulong added;//text pages read from disk and kept
+        ulong reaped;//pages given back under memory pressure
+        ulong invalidated;//files written,truncated or unlinked while cached
+    };
+
+    extern struct text_cache_stat text_cache_stat;
+    extern ulong xip_pages;
+
+    ulong text_cache_find(struct m_inode *inode,ulong index);
+    bool text_cache_add(struct m_inode *inode,ulong index,ulong page,uint32_t gen);
+    ulong text_cache_reap();
+    void text_cache_invalidate(struct m_inode *inode);
+    void text_cache_invalidate_dev(int dev);
+    void show_text_cache();
 
 #endif
@@ -5,8 +5,10 @@
     #include "linux/fs.h"
     #include "linux/mm.h"
     #include "signal.h"
+    #include "linux/kstack.h"
 
     #define NR_TASKS 64
+    #define NR_KERNEL_STACKS (NR_TASKS + CORE_NUM - 1)//the idle tasks of the other cores come after task[]
     #define HZ 100
     
     #define FIRST_TASK task[0]
@@ -22,12 +24,15 @@
     #define TASK_ZOMBIE 3
     #define TASK_STOPPED 4
 
-    #define KERNEL_STACK_SIZE 32768
+    #define TASK_STRUCT_PAGES 2//task_struct and its page directory
+
+    #define KERNEL_STACK_MAGIC 0x57AC4E5D57AC4E5DUL
 
     extern int copy_page_tables(ulong from,ulong to,volatile pte_sv39 *to_dir,ulong size);
     extern int free_page_tables(ulong from,volatile pte_sv39 *dir,ulong size);
 
     extern void sched_init();
+    extern void set_page_dir(volatile pte_sv39 *dir_table);
     extern bool schedule();
     extern void panic(const char *str);
     typedef int64_t (*fn_ptr)();
@@ -39,6 +44,26 @@
         ulong epc;
     };
 
+    //kernel/hrtimer.c
+    struct hrtimer
+    {
+        ulong expires;//CLINT time
+        void (*fn)(struct hrtimer *timer);//called from the timer interrupt
+        void *data;
+        struct hrtimer *next;
+        bool queued;
+    };
+
+    //kernel/sched.c,a timer of the timer wheel
+    struct timer_list
+    {
+        int64_t expires;//jiffies
+        void (*fn)(struct timer_list *timer);//called from the tick with interrupts off
+        ulong data;
+        struct timer_list *next,*prev;
+        int64_t slot;//in the wheel,-1 if not pending
+    };
+
     struct task_struct
     {
         int64_t state;//-1 unrunnable 0 runnable >0 stopped
@@ -52,7 +77,10 @@
         int64_t pid,father,pgrp,session,leader;
         uint16_t uid,euid,suid;
         uint16_t gid,egid,sgid;
-        int64_t alarm;
+        int64_t alarm;//jiffies,0 if none
+        struct timer_list alarm_timer;
+        struct hrtimer real_timer;//ITIMER_REAL
+        ulong it_real_incr;//interval of ITIMER_REAL in CLINT cycles,0 for a one-shot timer
         int64_t utime,stime,cutime,cstime,start_time;
         //file system info
         int tty;//-1 if no tty,so it must be signed
@@ -62,7 +90,20 @@
         struct m_inode *executable;
         ulong close_on_exec;
         struct file *filp[NR_OPEN];
-        volatile pte_sv39 *page_dir_table;
+        volatile pte_sv39 *page_dir_table;//borrowed from the parent after vfork() until exec or exit
+        volatile pte_sv39 *page_root;//a root table of its own if the hart has ASIDs,else the shared page_root_table
+        ulong asid;//generation and ASID,see switch_mm().0 makes the next switch pick a new one
+        struct task_struct *vfork_parent;//parent sleeping in vfork(),NULL otherwise
+        struct task_struct *vfork_wait;
+        struct vm_area_struct *mmap;//sorted by address,NULL for tasks which never did exec
+        ulong mlock;//MCL_* flags of mlockall(),the pages are neither swapped nor dropped.Not inherited
+        ulong tlb_batch_depth;//see tlb_batch_start()
+        bool tlb_batch_pending;
+        int64_t nr;//slot in task[]
+        struct run_array *run_array;//run queue the task waits in,NULL while it runs or sleeps
+        int64_t run_level;
+        struct task_struct *run_next,*run_prev;
+        ulong run_epoch;//counter recalculations already applied,see kernel/sched.c
         ulong code_base;
         ulong data_base;
         ulong code_limit;
@@ -71,18 +112,130 @@
     };
 
     extern struct task_struct *task[NR_TASKS];
-    extern struct task_struct *current;
-    extern ulong kernel_stack[NR_TASKS];
-    extern ulong kernel_stackbottom[NR_TASKS];
+    extern struct task_struct *core_current[CORE_NUM];
+    extern struct task_struct *idle_task[CORE_NUM];//idle_task[0] is task[0]
+    extern ulong kernel_stack[NR_KERNEL_STACKS];
+    extern ulong kernel_stackbottom[NR_KERNEL_STACKS];
+
+    #define current (core_current[current_coreid()])//the task on the hart running this code
+    #define is_idle_task(p) (((p) -> nr == 0) || ((p) -> nr >= NR_TASKS))
+
     extern int64_t volatile jiffies;
     extern int64_t startup_time;
 
     #define CURRENT_TIME (startup_time + jiffies / HZ)
 
-    extern void add_timer(long jiffies,void (*fn)());
+    extern void init_timer(struct timer_list *timer,void (*fn)(struct timer_list *timer),ulong data);
+    extern void mod_timer(struct timer_list *timer,int64_t expires);
+    extern bool del_timer(struct timer_list *timer);
+    extern int64_t add_timer(int64_t delay,void (*fn)());
     extern void sleep_on(struct task_struct **p);
     extern void interruptible_sleep_on(struct task_struct **p);
     extern void wake_up(struct task_struct **p);
+    extern void wake_up_process(struct task_struct *p);
+    extern void signal_wake_up(struct task_struct *p);
+    extern void set_alarm(int64_t alarm);
+    extern void alarm_fn(struct timer_list *timer);
+    extern bool signal_pending(struct task_struct *p);
+
+    struct sched_stat
+    {
+        ulong calls;
+        ulong cycles;//spent in schedule() before switch_to()
+        ulong recalcs;//counter recalculations,each a swap of the run arrays
+        ulong timers_run;
+        ulong timer_cascades;//timers moved to a lower level of the wheel
+        ulong tick_irqs[CORE_NUM];//tick interrupts taken
+        ulong tick_ticks[CORE_NUM];//ticks of time that passed,the ones without an interrupt were avoided
+        ulong tick_stops;
+    };
+
+    extern struct sched_stat sched_stat;
+    extern void show_sched();
+    extern bool task_running(struct task_struct *p);
+    extern bool sched_runnable();
+    extern struct task_struct *idle_task_init(ulong id);
+    extern void update_process_times(ulong ticks);
+    extern ulong tick_cycles;
+    extern void tick_stop(struct task_struct *next);
+    extern void tick_restart(ulong id);
+    extern void tick_update();
+
+    //kernel/smp.c
+    struct smp_stat
+    {
+        ulong ticks[CORE_NUM];
+        ulong idle_ticks[CORE_NUM];//ticks which found the idle task running
+        ulong lock_waits[CORE_NUM];//kernel entries which had to wait for the other core
+        ulong ipis[CORE_NUM];//received
+        ulong shootdowns;//TLB flushes another core was interrupted for
+        ulong lazy_flushes;//TLB flushes left to an idle core until it switches to a task
+    };
+
+    extern struct smp_stat smp_stat;
+    extern bool core_online[CORE_NUM];
+    extern void smp_init(privilege_targetfunc idle);
+    extern void smp_enter_user(privilege_targetfunc idle);
+    extern void lock_kernel();
+    extern void unlock_kernel();
+    extern void smp_send_reschedule();
+    extern void smp_ipi_interrupt();
+    extern void smp_timer_interrupt();
+    extern void cpu_idle_wait();
+    extern void show_smp();
+
+    struct hrtimer_stat
+    {
+        ulong started;
+        ulong fired;
+        ulong late_cycles;//CLINT cycles between the expiry and the interrupt
+    };
+
+    extern struct hrtimer_stat hrtimer_stat;
+    extern void hrtimers_init();
+    extern ulong hrtimer_now();
+    extern void hrtimer_init(struct hrtimer *timer,void (*fn)(struct hrtimer *timer),void *data);
+    extern void hrtimer_start(struct hrtimer *timer,ulong expires);
+    extern bool hrtimer_cancel(struct hrtimer *timer);
+    extern void hrtimer_interrupt();
+    extern void it_real_fn(struct hrtimer *timer);
+    extern void show_hrtimer();
+
+    //kernel/offload.c
+    #define OFFLOAD_ZERO 1
+    #define OFFLOAD_COPY 2
+
+    struct offload_job
+    {
+        ulong type;
+        void *dst;
+        const void *src;//OFFLOAD_COPY only
+        ulong len;
+        void (*done)(struct offload_job *job);//called by offload_reap(),may be NULL
+    };
+
+    struct offload_stat
+    {
+        ulong posted;
+        ulong bytes;
+        ulong split_ops;//zeroing and copies core 1 did half of
+        ulong inline_ops;//big enough to split,but the caller did them alone
+        ulong zeroed_pages;//pages allocated from the pool core 1 zeroed ahead
+    };
+
+    extern struct offload_stat offload_stat;
+    extern bool offload_post(ulong type,void *dst,const void *src,ulong len,void (*done)(struct offload_job *),ulong *ticket);
+    extern bool offload_done(ulong ticket);
+    extern void offload_run();
+    extern void offload_reap();
+    extern void offload_init();
+    extern void offload_zero(void *dst,ulong len);
+    extern void show_offload();
+    extern void vfork_release();
+    extern void kernel_stack_guard_init(int nr);
+    extern ulong kernel_stack_used(int nr);
+    extern void kernel_stack_account(int nr);
+    extern void show_stat();
 
     #define PAGE_ALIGN(n) (((n) + 0xFFF) & 0xFFFFF000)
 
@@ -0,0 +1,32 @@
+#ifndef __SYS_MMAN_H__
+#define __SYS_MMAN_H__
+
+    #include <sys/types.h>
+
+    #define PROT_NONE 0x0
+    #define PROT_READ 0x1
+    #define PROT_WRITE 0x2
+    #define PROT_EXEC 0x4
+
+    #define MAP_SHARED 0x01//only read-only shared mappings are supported
+    #define MAP_PRIVATE 0x02
+    #define MAP_FIXED 0x10
+
+    #define MAP_FAILED ((void *)-1)
+
+    #define MCL_CURRENT 0x01//fault in everything mapped now
+    #define MCL_FUTURE 0x02//and everything brk() or mmap() adds later
+
+    #define MADV_NORMAL 0
+    #define MADV_RANDOM 1//no fault-around or read-ahead
+    #define MADV_SEQUENTIAL 2//bigger fault-around and read-ahead
+    #define MADV_WILLNEED 3//start reading the file behind the range
+    #define MADV_DONTNEED 4//free the pages,they fault back in from the file or as zeroes
+
+    extern void *mmap(void *addr,size_t len,int prot,int flags,int fd,off_t offset);
+    extern int munmap(void *addr,size_t len);
+    extern int mlockall(int flags);
+    extern int munlockall(void);
+    extern int madvise(void *addr,size_t len,int advice);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef __SYS_TIME_H__
+#define __SYS_TIME_H__
+
+    #include <sys/types.h>
+
+    #define ITIMER_REAL 0
+    #define ITIMER_VIRTUAL 1
+    #define ITIMER_PROF 2
+
+    struct timespec
+    {
+        time_t tv_sec;
+        long tv_nsec;
+    };
+
+    struct timeval
+    {
+        time_t tv_sec;
+        long tv_usec;
+    };
+
+    struct itimerval
+    {
+        struct timeval it_interval;//reload value,0 for a one-shot timer
+        struct timeval it_value;//time left,0 if disarmed
+    };
+
+    extern int nanosleep(const struct timespec *req,struct timespec *rem);
+    extern int getitimer(int which,struct itimerval *value);
+    extern int setitimer(int which,const struct itimerval *value,struct itimerval *ovalue);
+
+#endif
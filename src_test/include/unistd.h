@@ -182,12 +182,16 @@
     #define __NR_setreuid 50
     #define __NR_setregid 51
     #define __NR_debug 52
+    #define __NR_vfork 53
     #define __NR_close 57
     #define __NR_lseek 62
     #define __NR_read 63
     #define __NR_write 64
     #define __NR_fstat 80
     #define __NR_exit 93
+    #define __NR_nanosleep 101
+    #define __NR_getitimer 102
+    #define __NR_setitimer 103
     #define __NR_kill 129
     #define __NR_times 153
     #define __NR_uname 160
@@ -197,6 +201,12 @@
     #define __NR_getgid 176
     #define __NR_getegid 177
     #define __NR_brk 214
+    #define __NR_munmap 215
+    #define __NR_mmap 222
+    #define __NR_fadvise64 223
+    #define __NR_mlockall 230
+    #define __NR_munlockall 231
+    #define __NR_madvise 233
     #define __NR_open 1024
     #define __NR_link 1025
     #define __NR_unlink 1026
@@ -336,8 +346,70 @@
         return -1; \
     }
 
+    #define _syscall4(type,name,atype,a,btype,b,ctype,c,dtype,d) \
+    type usersyscall_##name(atype a,btype b,ctype c,dtype d) \
+    { \
+        int64_t __res; \
+        register ulong a7 asm("a7") = __NR_##name;\
+        register ulong a0 asm("a0") = (ulong)a;\
+        register ulong a1 asm("a1") = (ulong)b;\
+        register ulong a2 asm("a2") = (ulong)c;\
+        register ulong a3 asm("a3") = (ulong)d;\
+        asm volatile ("ecall;mv %0,a0" \
+	        : "=r" (__res) \
+	        : "r"(a7),"r"(a0),"r"(a1),"r"(a2),"r"(a3)); \
+        \
+        if(__res >= 0) \
+        {\
+	        return (type) __res; \
+        }\
+        \
+        errno = -__res; \
+        return -1; \
+    }
+
+    #define _syscall6(type,name,atype,a,btype,b,ctype,c,dtype,d,etype,e,ftype,f) \
+    type usersyscall_##name(atype a,btype b,ctype c,dtype d,etype e,ftype f) \
+    { \
+        int64_t __res; \
+        register ulong a7 asm("a7") = __NR_##name;\
+        register ulong a0 asm("a0") = (ulong)a;\
+        register ulong a1 asm("a1") = (ulong)b;\
+        register ulong a2 asm("a2") = (ulong)c;\
+        register ulong a3 asm("a3") = (ulong)d;\
+        register ulong a4 asm("a4") = (ulong)e;\
+        register ulong a5 asm("a5") = (ulong)f;\
+        asm volatile ("ecall;mv %0,a0" \
+	        : "=r" (__res) \
+	        : "r"(a7),"r"(a0),"r"(a1),"r"(a2),"r"(a3),"r"(a4),"r"(a5)); \
+        \
+        if(__res >= 0) \
+        {\
+	        return (type) __res; \
+        }\
+        \
+        errno = -__res; \
+        return -1; \
+    }
+
     #endif /* __LIBRARY__ */
 
+    //sys_debug() requests,other values are only logged
+    #define DEBUG_REQUEST_BASE 0x10000
+    #define DEBUG_SHOW_MEM (DEBUG_REQUEST_BASE + 0)
+    #define DEBUG_SHOW_SWAP (DEBUG_REQUEST_BASE + 1)
+    #define DEBUG_SHOW_SLAB (DEBUG_REQUEST_BASE + 2)
+    #define DEBUG_MEGAPAGE_ON (DEBUG_REQUEST_BASE + 3)
+    #define DEBUG_MEGAPAGE_OFF (DEBUG_REQUEST_BASE + 4)
+    #define DEBUG_PGTABLE_SHARE_ON (DEBUG_REQUEST_BASE + 5)
+    #define DEBUG_PGTABLE_SHARE_OFF (DEBUG_REQUEST_BASE + 6)
+    #define DEBUG_SHOW_VMA (DEBUG_REQUEST_BASE + 7)
+    #define DEBUG_SHOW_TASK (DEBUG_REQUEST_BASE + 8)
+    #define DEBUG_SHOW_SCHED (DEBUG_REQUEST_BASE + 9)
+    #define DEBUG_SCHED_RESET (DEBUG_REQUEST_BASE + 10)
+    #define DEBUG_SHOW_SMP (DEBUG_REQUEST_BASE + 11)
+    #define DEBUG_SWAP_OUT (DEBUG_REQUEST_BASE + 12)
+
     extern int errno;
 
     /*int access(const char * filename, mode_t mode);
@@ -362,6 +434,7 @@
     volatile void _exit(int status);
     int fcntl(int fildes, int cmd, ...);
     int fork(void);
+    int vfork(void);
     int getpid(void);
     int getuid(void);
     int geteuid(void);
@@ -44,6 +44,62 @@ void do_rd_request()
     goto repeat;
 }
 
+#ifdef CONFIG_RAMDISK_XIP
+//Execute-in-place.Return the address of the page holding blocks b[0..3] if they follow each other on one page
+//of the ramdisk and the ramdisk is up to date,otherwise 0 and the page has to be read
+ulong rd_xip_page(int dev,int b[4])
+{
+    ulong addr;
+    int i;
+
+    if((MAJOR(dev) != MAJOR_NR) || (!b[0]))
+    {
+        return 0;
+    }
+
+    addr = (ulong)rd_start + b[0] * BLOCK_SIZE;
+
+    if((addr & (PAGE_SIZE - 1)) || (addr + PAGE_SIZE > (ulong)rd_start + rd_length))
+    {
+        return 0;
+    }
+
+    for(i = 0;i < 4;i++)
+    {
+        if((b[i] != b[0] + i) || buffer_dirty(dev,b[i]))
+        {
+            return 0;
+        }
+    }
+
+    return addr;
+}
+#endif
+
+//The pages of a running executable on the ramdisk may be mapped in place,they hold no reference to its blocks.
+//Its blocks must neither change nor be freed,so it can't be written,truncated or unlinked meanwhile
+bool rd_xip_busy(struct m_inode *inode)
+{
+    #ifdef CONFIG_RAMDISK_XIP
+        struct task_struct **p;
+
+        if(MAJOR(inode -> i_dev) != MAJOR_NR)
+        {
+            return false;
+        }
+
+        for(p = &LAST_TASK;p >= &FIRST_TASK;--p)
+        {
+            if((*p) && ((*p) -> executable == inode))
+            {
+                return true;
+            }
+        }
+    #endif
+
+    return false;
+}
+
 ulong rd_init(ulong mem_start,ulong length)
 {
     ulong i;
@@ -19,7 +19,7 @@ void serial_send_interrupt(void *ctx)
 
     if(cur -> proc_list != NULL)
     {
-        cur -> proc_list -> state = TASK_RUNNING;
+        wake_up_process(cur -> proc_list);
     }
 
     if(size != 0)
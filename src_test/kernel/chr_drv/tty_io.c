@@ -85,6 +85,7 @@ void tty_intr(struct tty_struct *tty,int mask)
         if(task[i] && (task[i] -> pgrp == tty -> pgrp))
         {
             task[i] -> signal |= mask;
+            signal_wake_up(task[i]);
         }
     }
 }
@@ -283,7 +284,7 @@ int64_t tty_read(ulong channel,char *buf,int64_t nr)
 
         if(flag = ((!oldalarm) || ((time + jiffies) < oldalarm)))
         {
-            current -> alarm = time + jiffies;
+            set_alarm(time + jiffies);
         }
     }
 
@@ -340,11 +341,11 @@ int64_t tty_read(ulong channel,char *buf,int64_t nr)
         {
             if(flag = ((!oldalarm) || ((time + jiffies) < oldalarm)))
             {
-                current -> alarm = time + jiffies;
+                set_alarm(time + jiffies);
             }
             else
             {
-                current -> alarm = oldalarm;
+                set_alarm(oldalarm);
             }
         }
 
@@ -361,7 +362,7 @@ int64_t tty_read(ulong channel,char *buf,int64_t nr)
         }
     }
 
-    current -> alarm = oldalarm;
+    set_alarm(oldalarm);
 
     if(current -> signal && (!(b - buf)))
     {
@@ -24,7 +24,14 @@ void release(struct task_struct *p)
         if(task[i] == p)
         {
             task[i] = NULL;
-            free_pages((ulong)p,5);
+            kernel_stack_account(i);
+
+            if(p -> page_root != page_root_table)
+            {
+                free_page((ulong)p -> page_root);
+            }
+
+            free_pages((ulong)p,TASK_STRUCT_PAGES);
             free_pages((ulong)kernel_stackbottom[i],KERNEL_STACK_SIZE >> PAGING_SHIFT);
             kernel_stackbottom[i] = kernel_stack[i] = NULL;
             schedule();
@@ -45,6 +52,7 @@ static inline int send_sig(int sig,struct task_struct *p,int priv)
     if(priv || (current -> euid == p -> euid) || suser())
     {
         p -> signal |= (1 << (sig - 1));
+        signal_wake_up(p);
     }
     else
     {
@@ -63,6 +71,7 @@ static void kill_session()
         if((*p) && ((*p) -> session == current -> session))
         {
             (*p) -> signal |= 1 << (SIGHUP - 1);
+            signal_wake_up(*p);
         }
     }   
 }
@@ -145,6 +154,7 @@ static void tell_father(int pid)
             }
             
             task[i] -> signal |= (1 << (SIGCHLD - 1));
+            signal_wake_up(task[i]);
             return;
         }
     }
@@ -159,11 +169,18 @@ volatile void do_exit(int code)
 {
     int i;
 
-    if(current -> page_dir_table != NULL)
+    vfork_release();
+    hrtimer_cancel(&current -> real_timer);
+    del_timer(&current -> alarm_timer);
+    tlb_batch_start();
+
+    if((!exit_mmap()) && (current -> page_dir_table != NULL))
     {
-        free_page_tables(current -> page_dir_table,current -> page_dir_table,PAGE_DIR_TABLE_NUM);
+        defer_page_tables(USER_START_ADDR,current -> page_dir_table,PAGE_DIR_TABLE_NUM << PAGING_HIGH_LEVEL_SHIFT);
     }
 
+    tlb_batch_end();
+
     for(i = 0;i < NR_TASKS;i++)
     {
         if(task[i] && (task[i] -> father == current -> pid))
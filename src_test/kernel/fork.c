@@ -7,8 +7,6 @@
 extern void write_verify(ulong address);
 extern void fork_process_exit();
 
-extern trap_info_t trap_info;
-
 int last_pid = 0;
 
 void verify_area(void *addr,int size)
@@ -32,6 +30,7 @@ int copy_mem(int nr,struct task_struct *p)
     ulong old_code_base,old_data_base;
     ulong new_code_base,new_data_base;
     ulong code_limit,data_limit;
+    int err = 0;
 
     old_code_base = p -> code_base;
     old_data_base = p -> data_base;
@@ -41,21 +40,31 @@ int copy_mem(int nr,struct task_struct *p)
     p -> start_code = new_code_base;
     //syslog_print("data_limit = %d\r\n",data_limit);
 
-    if(copy_page_tables(old_data_base,new_data_base,p -> page_dir_table,data_limit / PAGE_SIZE))
+    //the parent's entries are write-protected area by area,the TLB is flushed once at the end
+    tlb_batch_start();
+
+    //only the page tables under the areas are copied
+    if(current -> mmap)
+    {
+        err = dup_mmap(p);
+    }
+    else if(copy_page_tables(old_data_base,new_data_base,p -> page_dir_table,data_limit))
     {
         free_page_tables(new_data_base,p -> page_dir_table,data_limit);
-        return -ENOMEM;
+        err = -ENOMEM;
     }
 
-    return 0;
+    tlb_batch_end();
+    return err;
 }
 
-int copy_process(int nr)
+//With borrow_mm the child runs on the parent's page_dir_table,its own one is set up by vfork_release()
+static int do_copy_process(int nr,bool borrow_mm)
 {
     struct task_struct *p;
     int i;
     struct file *f;
-    p = (struct task_struct *)get_free_pages(5);
+    p = (struct task_struct *)get_free_pages(TASK_STRUCT_PAGES);
 
     if(!p)
     {
@@ -66,23 +75,34 @@ int copy_process(int nr)
     task[nr] = p;
     *p = *current;//this doesn't copy the supervisor stack
     p -> state = TASK_UNINTERRUPTIBLE;
+    p -> nr = nr;
+    p -> run_array = NULL;
     p -> pid = last_pid;
     p -> father = current -> pid;
     p -> counter = p -> priority;
     p -> signal = 0;
     p -> alarm = 0;
+    init_timer(&p -> alarm_timer,alarm_fn,(ulong)p);
+    hrtimer_init(&p -> real_timer,it_real_fn,p);
+    p -> it_real_incr = 0;
     p -> leader = 0;//process leadership doesn't inherit
     p -> utime = p -> stime = 0;
     p -> cutime = p -> cstime = 0;
     p -> start_time = jiffies;
+    p -> vfork_parent = NULL;
+    p -> vfork_wait = NULL;
+    p -> mlock = 0;
+    p -> tlb_batch_depth = 0;
+    p -> tlb_batch_pending = false;
     kernel_stackbottom[nr] = kernel_stack[nr] = get_free_pages(KERNEL_STACK_SIZE >> PAGING_SHIFT);
 
     if(!kernel_stack[nr])
     {
-        free_pages(p,5);
+        free_pages(p,TASK_STRUCT_PAGES);
         return -EAGAIN;
     }
 
+    kernel_stack_guard_init(nr);
     kernel_stack[nr] += KERNEL_STACK_SIZE;
     p -> tss.regs[reg_sp] = kernel_stack[nr] - sizeof(trap_info.regs[0]) * 32 - sizeof(trap_info.fregs[0]) * 32;
     
@@ -96,18 +116,43 @@ int copy_process(int nr)
     *(((ulong *)(p -> tss.regs[reg_sp])) + reg_a0) = 0;
     *(((ulong *)(p -> tss.regs[reg_sp])) + reg_ra) = fork_process_exit;
     *((ulong *)(p -> tss.regs[reg_sp] - 8)) = trap_info.regs[reg_ra];
-    p -> page_dir_table = ((ulong)p) + PAGE_SIZE;
-    //syslog_print("task %d,p -> page_dir_table = %p\r\n",nr,p -> page_dir_table);
-    pte_common_init(p -> page_dir_table,PAGE_DIR_TABLE_NUM);
+
+    if(borrow_mm)
+    {
+        p -> vfork_parent = current;
+    }
+    else
+    {
+        p -> mmap = NULL;
+        p -> page_dir_table = ((ulong)p) + PAGE_SIZE;
+        //syslog_print("task %d,p -> page_dir_table = %p\r\n",nr,p -> page_dir_table);
+        pte_common_init(p -> page_dir_table,PAGE_DIR_TABLE_NUM);
+    }
+
+    //with ASIDs the child's translations are tagged apart from the parent's,so it needs its own root table
+    p -> asid = 0;
+    p -> page_root = page_root_table;
+
+    if(asid_bits && (p -> page_root = (volatile pte_sv39 *)get_free_page()))
+    {
+        memcpy((void *)p -> page_root,(void *)current -> page_root,sizeof(page_root_table));
+        pte_common_addr_to_ppn((volatile pte_64model *)&p -> page_root[3],(ulong)p -> page_dir_table);
+    }
     
     syslog_debug("copy_process","4");
     
-    if(copy_mem(nr,p))
+    if((!p -> page_root) || ((!borrow_mm) && copy_mem(nr,p)))
     {
         syslog_debug("copy_process","5");
         task[nr] = NULL;
+
+        if(p -> page_root && (p -> page_root != page_root_table))
+        {
+            free_page((ulong)p -> page_root);
+        }
+
         free_pages(kernel_stack[nr] - KERNEL_STACK_SIZE,KERNEL_STACK_SIZE >> PAGING_SHIFT);
-        free_pages((ulong)p,5);
+        free_pages((ulong)p,TASK_STRUCT_PAGES);
         return -EAGAIN;
     }
     
@@ -134,10 +179,15 @@ int copy_process(int nr)
         current -> executable -> i_count++;
     }
 
-    p -> state = TASK_RUNNING;
+    wake_up_process(p);
     return last_pid;
 }
 
+int copy_process(int nr)
+{
+    return do_copy_process(nr,false);
+}
+
 int find_empty_process()
 {
     int i;
@@ -165,4 +215,51 @@ int find_empty_process()
     }
 
     return -EAGAIN;
+}
+
+//The child shares the parent's address space and the parent sleeps until the child calls execve() or exits,
+//so nothing is copied and neither side takes COW faults.The child must not return from the calling function
+int64_t sys_vfork()
+{
+    struct task_struct *p;
+    int nr,pid;
+
+    if((nr = find_empty_process()) < 0)
+    {
+        return nr;
+    }
+
+    if((pid = do_copy_process(nr,true)) < 0)
+    {
+        return pid;
+    }
+
+    p = task[nr];
+
+    //the child can't be released before we wait for it,so p stays valid
+    while(p -> vfork_parent == current)
+    {
+        sleep_on(&current -> vfork_wait);
+    }
+
+    return pid;
+}
+
+//Give a borrowed address space back to the vfork() parent and switch to our own empty page directory
+void vfork_release()
+{
+    struct task_struct *parent = current -> vfork_parent;
+
+    if(!parent)
+    {
+        return;
+    }
+
+    current -> vfork_parent = NULL;
+    parent -> asid = 0;//the child changed the parent's entries under its own ASID
+    current -> mmap = NULL;//the areas are the parent's too
+    current -> page_dir_table = (volatile pte_sv39 *)(((ulong)current) + PAGE_SIZE);
+    pte_common_init((volatile pte_64model *)current -> page_dir_table,PAGE_DIR_TABLE_NUM);
+    set_page_dir(current -> page_dir_table);
+    wake_up(&parent -> vfork_wait);
 }
\ No newline at end of file
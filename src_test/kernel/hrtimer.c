@@ -0,0 +1,377 @@
+#include "common.h"
+#include "errno.h"
+#include "linux/sched.h"
+#include "linux/kernel.h"
+#include "sys/time.h"
+#include "asm/segment.h"
+
+//High resolution timers.They go off at a CLINT time rather than at a jiffy,so their resolution is a CLINT cycle
+//(50 cpu cycles).The timers waiting are kept sorted by expiry in a list,the first one is set in the CLINT timer
+//of core 0,which the tick doesn't use.Their functions are called from that interrupt with the kernel lock held
+//and may start the timer again.nanosleep() and the ITIMER_REAL interval timer are built on them
+
+#define NSEC_PER_SEC 1000000000UL
+#define USEC_PER_SEC 1000000UL
+#define HRTIMER_MAX_SEC 0x7FFFFFFFUL//longer times are cut to this,about 68 years
+#define ITIMER_MIN_USEC 100//shorter interval timers are made this long,so they can't keep core 0 in the interrupt
+
+extern uint64_t clint_timer_get_freq(void);
+extern void verify_area(void *addr,int size);
+
+static struct hrtimer *hrtimer_head = NULL;
+static ulong hrtimer_freq;//CLINT cycles per second
+struct hrtimer_stat hrtimer_stat;
+
+ulong hrtimer_now()
+{
+    return clint -> mtime;
+}
+
+//CLINT cycles in sec seconds and frac fractions of a second,rounded up so that a sleep is never short
+static ulong time_to_cycles(ulong sec,ulong frac,ulong frac_per_sec)
+{
+    if(sec > HRTIMER_MAX_SEC)
+    {
+        sec = HRTIMER_MAX_SEC;
+    }
+
+    return sec * hrtimer_freq + (frac * hrtimer_freq + frac_per_sec - 1) / frac_per_sec;
+}
+
+static void cycles_to_time(ulong cycles,ulong frac_per_sec,time_t *sec,long *frac)
+{
+    *sec = cycles / hrtimer_freq;
+    *frac = (cycles % hrtimer_freq) * frac_per_sec / hrtimer_freq;
+}
+
+static void hrtimer_program()
+{
+    clint -> mtimecmp[0] = hrtimer_head ? hrtimer_head -> expires : ~0UL;
+}
+
+void hrtimer_init(struct hrtimer *timer,void (*fn)(struct hrtimer *timer),void *data)
+{
+    timer -> expires = 0;
+    timer -> fn = fn;
+    timer -> data = data;
+    timer -> next = NULL;
+    timer -> queued = false;
+}
+
+//interrupts must be off
+static void hrtimer_dequeue(struct hrtimer *timer)
+{
+    struct hrtimer **p;
+
+    for(p = &hrtimer_head;*p;p = &((*p) -> next))
+    {
+        if(*p == timer)
+        {
+            *p = timer -> next;
+            break;
+        }
+    }
+
+    timer -> next = NULL;
+    timer -> queued = false;
+}
+
+//Start timer to go off at the CLINT time expires,a timer already waiting is moved
+void hrtimer_start(struct hrtimer *timer,ulong expires)
+{
+    struct hrtimer **p;
+    csr_define_common mstatus,mie;
+
+    mstatus = csr_read(csr_mstatus);
+    mie = csr_read(csr_mie);
+    sysctl_disable_irq();
+
+    if(timer -> queued)
+    {
+        hrtimer_dequeue(timer);
+    }
+
+    timer -> expires = expires;
+
+    for(p = &hrtimer_head;(*p) && ((*p) -> expires <= expires);p = &((*p) -> next));
+
+    timer -> next = *p;
+    timer -> queued = true;
+    *p = timer;
+    hrtimer_stat.started++;
+
+    if(hrtimer_head == timer)
+    {
+        hrtimer_program();
+    }
+
+    csr_write(csr_mie,mie);
+    csr_write(csr_mstatus,mstatus);
+}
+
+//Returns whether the timer was still waiting
+bool hrtimer_cancel(struct hrtimer *timer)
+{
+    bool queued,first;
+    csr_define_common mstatus,mie;
+
+    mstatus = csr_read(csr_mstatus);
+    mie = csr_read(csr_mie);
+    sysctl_disable_irq();
+    queued = timer -> queued;
+    first = (hrtimer_head == timer);
+
+    if(queued)
+    {
+        hrtimer_dequeue(timer);
+
+        if(first)
+        {
+            hrtimer_program();
+        }
+    }
+
+    csr_write(csr_mie,mie);
+    csr_write(csr_mstatus,mstatus);
+    return queued;
+}
+
+//The CLINT timer of core 0 went off
+void hrtimer_interrupt()
+{
+    struct hrtimer *timer;
+    ulong now = hrtimer_now();
+
+    while((timer = hrtimer_head) && (timer -> expires <= now))
+    {
+        hrtimer_head = timer -> next;
+        timer -> next = NULL;
+        timer -> queued = false;
+        hrtimer_stat.fired++;
+        hrtimer_stat.late_cycles += now - timer -> expires;
+        //a timer started again by its function waits for the next interrupt,even if it is due by now
+        timer -> fn(timer);
+    }
+
+    hrtimer_program();
+}
+
+void hrtimers_init()
+{
+    csr_define_common csr;
+
+    hrtimer_freq = clint_timer_get_freq();
+    hrtimer_program();
+    csr = csr_read(csr_mie);
+    csr.mie.mtie = 1;
+    csr_write(csr_mie,csr);
+}
+
+//struct timespec and struct timeval are both a time_t and a long
+static void get_fs_time(const long *addr,time_t *sec,long *frac)
+{
+    *sec = get_fs_64long((const uint64_t *)addr);
+    *frac = get_fs_64long((const uint64_t *)(addr + 1));
+}
+
+static void put_fs_time(time_t sec,long frac,long *addr)
+{
+    put_fs_64long(sec,(uint64_t *)addr);
+    put_fs_64long(frac,(uint64_t *)(addr + 1));
+}
+
+static void hrtimer_wake(struct hrtimer *timer)
+{
+    wake_up_process((struct task_struct *)timer -> data);
+}
+
+int64_t sys_nanosleep(const struct timespec *req,struct timespec *rem)
+{
+    struct timespec t;
+    struct hrtimer timer;
+    ulong left = 0;
+
+    if(!req)
+    {
+        return -EFAULT;
+    }
+
+    get_fs_time((const long *)req,&t.tv_sec,&t.tv_nsec);
+
+    if((t.tv_sec < 0) || (t.tv_nsec < 0) || (t.tv_nsec >= NSEC_PER_SEC))
+    {
+        return -EINVAL;
+    }
+
+    hrtimer_init(&timer,hrtimer_wake,current);
+    hrtimer_start(&timer,hrtimer_now() + time_to_cycles(t.tv_sec,t.tv_nsec,NSEC_PER_SEC));
+
+    //the state is set first,so a wake up between the test and schedule() isn't lost
+    while(true)
+    {
+        current -> state = TASK_INTERRUPTIBLE;
+
+        if((!timer.queued) || signal_pending(current))
+        {
+            break;
+        }
+
+        schedule();
+    }
+
+    current -> state = TASK_RUNNING;
+
+    if(!hrtimer_cancel(&timer))
+    {
+        return 0;
+    }
+
+    if(timer.expires > hrtimer_now())
+    {
+        left = timer.expires - hrtimer_now();
+    }
+
+    if(rem)
+    {
+        verify_area(rem,sizeof(*rem));
+        cycles_to_time(left,NSEC_PER_SEC,&t.tv_sec,&t.tv_nsec);
+        put_fs_time(t.tv_sec,t.tv_nsec,(long *)rem);
+    }
+
+    return -EINTR;
+}
+
+//The ITIMER_REAL timer of a task went off
+void it_real_fn(struct hrtimer *timer)
+{
+    struct task_struct *p = (struct task_struct *)timer -> data;
+    ulong now;
+
+    p -> signal |= (1 << (SIGALRM - 1));
+    signal_wake_up(p);
+
+    if(!p -> it_real_incr)
+    {
+        return;
+    }
+
+    //periods missed while the interrupts were off are dropped,not delivered in a burst
+    now = hrtimer_now();
+    timer -> expires += p -> it_real_incr;
+
+    if(timer -> expires <= now)
+    {
+        timer -> expires = now + p -> it_real_incr;
+    }
+
+    hrtimer_start(timer,timer -> expires);
+}
+
+static void itimer_real_get(struct itimerval *value)
+{
+    ulong left = 0;
+    ulong now = hrtimer_now();
+
+    if(current -> real_timer.queued)
+    {
+        //a timer which is due but hasn't gone off yet still counts as armed
+        left = (current -> real_timer.expires > now) ? (current -> real_timer.expires - now) : 1;
+    }
+
+    cycles_to_time(left,USEC_PER_SEC,&value -> it_value.tv_sec,&value -> it_value.tv_usec);
+    cycles_to_time(current -> it_real_incr,USEC_PER_SEC,&value -> it_interval.tv_sec,&value -> it_interval.tv_usec);
+}
+
+static ulong itimer_cycles(const struct timeval *t)
+{
+    ulong cycles = time_to_cycles(t -> tv_sec,t -> tv_usec,USEC_PER_SEC);
+    ulong min = time_to_cycles(0,ITIMER_MIN_USEC,USEC_PER_SEC);
+
+    return (cycles && (cycles < min)) ? min : cycles;
+}
+
+static void put_fs_itimerval(const struct itimerval *v,struct itimerval *addr)
+{
+    verify_area(addr,sizeof(*addr));
+    put_fs_time(v -> it_interval.tv_sec,v -> it_interval.tv_usec,(long *)&addr -> it_interval);
+    put_fs_time(v -> it_value.tv_sec,v -> it_value.tv_usec,(long *)&addr -> it_value);
+}
+
+static bool timeval_valid(const struct timeval *t)
+{
+    return (t -> tv_sec >= 0) && (t -> tv_usec >= 0) && (t -> tv_usec < USEC_PER_SEC);
+}
+
+//Only ITIMER_REAL,there is no accounting the virtual and profiling timers could run on
+int64_t sys_getitimer(int which,struct itimerval *value)
+{
+    struct itimerval v;
+
+    if(which != ITIMER_REAL)
+    {
+        return -EINVAL;
+    }
+
+    if(!value)
+    {
+        return -EFAULT;
+    }
+
+    itimer_real_get(&v);
+    put_fs_itimerval(&v,value);
+    return 0;
+}
+
+int64_t sys_setitimer(int which,const struct itimerval *value,struct itimerval *ovalue)
+{
+    struct itimerval v,old;
+
+    if(which != ITIMER_REAL)
+    {
+        return -EINVAL;
+    }
+
+    if(!value)
+    {
+        return -EFAULT;
+    }
+
+    get_fs_time((const long *)&value -> it_interval,&v.it_interval.tv_sec,&v.it_interval.tv_usec);
+    get_fs_time((const long *)&value -> it_value,&v.it_value.tv_sec,&v.it_value.tv_usec);
+
+    if((!timeval_valid(&v.it_value)) || (!timeval_valid(&v.it_interval)))
+    {
+        return -EINVAL;
+    }
+
+    if(ovalue)
+    {
+        itimer_real_get(&old);
+        put_fs_itimerval(&old,ovalue);
+    }
+
+    hrtimer_cancel(&current -> real_timer);
+    current -> it_real_incr = itimer_cycles(&v.it_interval);
+
+    if(v.it_value.tv_sec || v.it_value.tv_usec)
+    {
+        hrtimer_start(&current -> real_timer,hrtimer_now() + itimer_cycles(&v.it_value));
+    }
+
+    return 0;
+}
+
+//for debug only
+void show_hrtimer()
+{
+    struct hrtimer *timer;
+    ulong queued = 0;
+
+    for(timer = hrtimer_head;timer;timer = timer -> next)
+    {
+        queued++;
+    }
+
+    printk("hrtimer:%lu started,%lu fired,%lu cycles late on average,%lu waiting,%lu cycles per second\r\n",hrtimer_stat.started,hrtimer_stat.fired,
+           hrtimer_stat.fired ? hrtimer_stat.late_cycles / hrtimer_stat.fired : 0,queued,hrtimer_freq);
+}
@@ -0,0 +1,197 @@
+#include "common.h"
+#include "linux/sched.h"
+#include "linux/kernel.h"
+#include "linux/mm.h"
+
+//Bulk work for core 1.Jobs are posted to a ring by whoever holds the kernel lock and run by core 1 while its idle
+//task has nothing to do,outside the lock.One producer and one consumer,so the ring needs no lock:the producer
+//only writes head and the slots behind it,the consumer only tail.A job is finished once tail has passed it,
+//its done() is called later under the lock by offload_reap(),which frees the slot.
+//Jobs are only posted while core 1 is idle,a busy core 1 leaves the work to the caller.
+//Without CONFIG_SMP core 1 runs no tasks,it is started by offload_init() to do nothing but the jobs
+
+#define OFFLOAD_CORE 1
+#define OFFLOAD_RING_SIZE 32//a power of 2
+#define OFFLOAD_SPLIT_MIN (64 * 1024)//smaller zeroing or copies are done by the caller alone
+
+static struct offload_job ring[OFFLOAD_RING_SIZE];
+static volatile ulong ring_head = 0;//next slot the producer fills
+static volatile ulong ring_tail = 0;//next slot the consumer runs
+static ulong ring_reaped = 0;//next slot offload_reap() looks at
+static volatile bool offload_dedicated = false;//core 1 only runs jobs
+struct offload_stat offload_stat;
+
+//Post a job if core 1 can take it now.ticket is set to the number offload_done() wants
+bool offload_post(ulong type,void *dst,const void *src,ulong len,void (*done)(struct offload_job *),ulong *ticket)
+{
+    struct offload_job *job;
+
+    if((!offload_dedicated) && ((!core_online[OFFLOAD_CORE]) || (!is_idle_task(core_current[OFFLOAD_CORE]))))
+    {
+        return false;
+    }
+
+    offload_reap();
+
+    if(ring_head - ring_reaped >= OFFLOAD_RING_SIZE)
+    {
+        return false;
+    }
+
+    job = &ring[ring_head & (OFFLOAD_RING_SIZE - 1)];
+    job -> type = type;
+    job -> dst = dst;
+    job -> src = src;
+    job -> len = len;
+    job -> done = done;
+
+    if(ticket)
+    {
+        *ticket = ring_head;
+    }
+
+    mb();
+    ring_head++;
+    offload_stat.posted++;
+    offload_stat.bytes += len;
+    clint_ipi_send(OFFLOAD_CORE);
+    return true;
+}
+
+bool offload_done(ulong ticket)
+{
+    if((int64_t)(ring_tail - ticket) > 0)
+    {
+        //the job's results are read only after the tail that says they are there
+        mb();
+        return true;
+    }
+
+    return false;
+}
+
+//Run the posted jobs,called by core 1 with the kernel lock free or held by the other core
+void offload_run()
+{
+    struct offload_job *job;
+
+    if(current_coreid() != OFFLOAD_CORE)
+    {
+        return;
+    }
+
+    while(ring_tail != ring_head)
+    {
+        mb();
+        job = &ring[ring_tail & (OFFLOAD_RING_SIZE - 1)];
+
+        if(job -> type == OFFLOAD_ZERO)
+        {
+            memset(job -> dst,0,job -> len);
+        }
+        else
+        {
+            memcpy(job -> dst,job -> src,job -> len);
+        }
+
+        mb();
+        ring_tail++;
+    }
+}
+
+//Hand the finished jobs to their done(),under the kernel lock
+void offload_reap()
+{
+    struct offload_job *job;
+
+    while(ring_reaped != ring_tail)
+    {
+        mb();
+        job = &ring[ring_reaped & (OFFLOAD_RING_SIZE - 1)];
+
+        if(job -> done)
+        {
+            job -> done(job);
+        }
+
+        ring_reaped++;
+    }
+}
+
+//Zero or copy with core 1 doing the upper half if it is idle,the caller does the lower half meanwhile
+//and then waits for the other.Waiting is cheaper than a sleep and an IPI back for work of this size
+static void offload_split(ulong type,uint8_t *dst,const uint8_t *src,ulong len)
+{
+    ulong half = (len >> 1) & ~(sizeof(ulong) - 1);
+    ulong ticket;
+
+    if(len < OFFLOAD_SPLIT_MIN)
+    {
+        half = len;
+    }
+    else if(!offload_post(type,dst + half,src ? (src + half) : NULL,len - half,NULL,&ticket))
+    {
+        half = len;
+        offload_stat.inline_ops++;
+    }
+
+    if(type == OFFLOAD_ZERO)
+    {
+        memset(dst,0,half);
+    }
+    else
+    {
+        memcpy(dst,src,half);
+    }
+
+    if(half == len)
+    {
+        return;
+    }
+
+    while(!offload_done(ticket));
+
+    offload_stat.split_ops++;
+}
+
+void offload_zero(void *dst,ulong len)
+{
+    offload_split(OFFLOAD_ZERO,(uint8_t *)dst,NULL,len);
+}
+
+//Core 1 without tasks.Only its software interrupt is enabled,not taken but enough to end the wfi when a job
+//is posted.It is cleared before the ring is looked at,so a job posted meanwhile leaves it pending
+static int offload_core_main(void *ctx)
+{
+    csr_define_common csr;
+    ulong id;
+
+    core_init();
+    id = current_coreid();
+    csr = csr_read(csr_mie);
+    csr.mie.msie = 1;
+    csr_write(csr_mie,csr);
+    offload_dedicated = true;
+
+    while(true)
+    {
+        clint_ipi_clear(id);
+        offload_run();
+        asm volatile("wfi");
+    }
+
+    return 0;
+}
+
+//Called at boot if core 1 doesn't run tasks
+void offload_init()
+{
+    register_core1(offload_core_main,NULL);
+}
+
+//for debug only
+void show_offload()
+{
+    printk("offload:%lu jobs(%lu bytes) to core %d,%lu operations split,%lu done alone\r\n",offload_stat.posted,offload_stat.bytes,OFFLOAD_CORE,offload_stat.split_ops,offload_stat.inline_ops);
+    printk("offload:%lu pages allocated zeroed ahead\r\n",offload_stat.zeroed_pages);
+}
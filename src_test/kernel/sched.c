@@ -4,43 +4,101 @@
 #include "linux/sys.h"
 #include "signal.h"
 #include "plic.h"
+#include "errno.h"
 
 #define _S(nr) (1 << ((nr) - 1))
 #define _BLOCKABLE (~(_S(SIGKILL) | _S(SIGSTOP)))
 
 volatile pte_sv39 init_task_page_dir_table[PAGE_DIR_TABLE_NUM] ALIGN4K;
 
-extern trap_info_t trap_info;
-extern bool trap_from_interrupt;
 extern void switch_to_tss(struct tss_struct *oldtss,struct tss_struct *newtss);
 extern void stack_overflow_check();
+extern uint64_t get_sp();
+extern uint64_t clint_timer_get_freq(void);
+
+static ulong kernel_stack_max_used = 0;//deepest use seen in any task which has been released
+
+//Fill the guard zone at the bottom of the kernel stack of task nr
+void kernel_stack_guard_init(int nr)
+{
+    ulong *p = (ulong *)kernel_stackbottom[nr];
+    ulong i;
+
+    for(i = 0;i < KERNEL_STACK_GUARD_SIZE / sizeof(ulong);i++)
+    {
+        p[i] = KERNEL_STACK_MAGIC;
+    }
+}
+
+static inline bool kernel_stack_guard_ok(ulong bottom)
+{
+    return ((ulong *)(bottom + KERNEL_STACK_GUARD_SIZE))[-1] == KERNEL_STACK_MAGIC;
+}
+
+//Kernel stacks start zeroed,so the lowest non-zero byte above the guard zone is the deepest the stack has been
+ulong kernel_stack_used(int nr)
+{
+    uint8_t *p = (uint8_t *)(kernel_stackbottom[nr] + KERNEL_STACK_GUARD_SIZE);
+    uint8_t *top = (uint8_t *)kernel_stack[nr];
+
+    if(!kernel_stack_guard_ok(kernel_stackbottom[nr]))
+    {
+        return KERNEL_STACK_SIZE;
+    }
+
+    while((p < top) && (!*p))
+    {
+        p++;
+    }
+
+    return top - p;
+}
+
+//Called before the stack of task nr is freed
+void kernel_stack_account(int nr)
+{
+    ulong used = kernel_stack_used(nr);
+
+    if(used > kernel_stack_max_used)
+    {
+        kernel_stack_max_used = used;
+    }
+}
 
 void show_task(int nr,struct task_struct *p)
 {
-    int i,j = 4096 - sizeof(struct task_struct);
+    ulong used = kernel_stack_used(nr);
 
     printk("%d: pid = %d,state = %d,",nr,p -> pid,p -> state);
-    i = 0;
 
-    while((i < j) && (!((char *)(p + 1))[i]))
+    if(used >= KERNEL_STACK_SIZE)
     {
-        i++;
+        printk("kernel stack guard zone overwritten\r\n");
+    }
+    else
+    {
+        printk("%lu(of %lu) bytes used in kernel stack\r\n",used,KERNEL_STACK_SIZE - KERNEL_STACK_GUARD_SIZE);
     }
-
-    printk("%d(of %d) chars free in kernel stack\r\n",i,j);
 }
 
 void show_stat()
 {
     int i;
+    ulong used,max_used = kernel_stack_max_used,count = 0;
 
     for(i = 0;i < NR_TASKS;i++)
     {
         if(task[i])
         {
             show_task(i,task[i]);
+            used = kernel_stack_used(i);
+            max_used = (used > max_used) ? used : max_used;
+            count++;
         }
     }
+
+    printk("kernel stack:%lu bytes per task(%lu guard),deepest use %lu bytes\r\n",KERNEL_STACK_SIZE,KERNEL_STACK_GUARD_SIZE,max_used);
+    printk("%lu tasks,%lu pages each\r\n",count,TASK_STRUCT_PAGES + (KERNEL_STACK_SIZE >> PAGING_SHIFT));
 }
 
 union task_union
@@ -50,26 +108,59 @@ union task_union
 };
 
 static union task_union init_task ALIGN4BYTE;
+static union task_union core_idle_task[CORE_NUM - 1] ALIGN4BYTE;//the idle tasks of the other cores
 
 int64_t volatile jiffies = 0;
 long startup_time = 0;
-struct task_struct *current = &(init_task.task);
+struct task_struct *core_current[CORE_NUM] = {&(init_task.task)};
+struct task_struct *idle_task[CORE_NUM] = {&(init_task.task)};
 struct task_struct *task[NR_TASKS] = {&(init_task.task)};
-ulong kernel_stack[NR_TASKS] = {((ulong)(&init_task.stack)) + PAGE_SIZE + KERNEL_STACK_SIZE};
-ulong kernel_stackbottom[NR_TASKS] = {((ulong)(&init_task.stack))};
-ulong cur_kernel_stackbottom = 0;
-ulong cur_kernel_stack = 0;
-ulong old_kernel_stack = 0;
+ulong kernel_stack[NR_KERNEL_STACKS] = {((ulong)(&init_task.stack)) + PAGE_SIZE + KERNEL_STACK_SIZE};
+ulong kernel_stackbottom[NR_KERNEL_STACKS] = {((ulong)(&init_task.stack)) + PAGE_SIZE};
+//per hart,indexed by mhartid in kernel/sched_call.S and trap/machine_trap.S as well
+ulong cur_kernel_stackbottom[CORE_NUM];
+ulong cur_kernel_stack[CORE_NUM];
+ulong old_kernel_stack[CORE_NUM];
 
 long user_stack[PAGE_SIZE >> 2];//2 page
 
-void set_page_dir(pte_sv39 *dir_table)
+//Make dir_table the directory of the current task and load its address space
+void set_page_dir(volatile pte_sv39 *dir_table)
 {
-    page_dir_table = dir_table;
-    pte_common_addr_to_ppn((volatile pte_64model *)&page_root_table[3],(ulong)dir_table);
-    pte_common_enable_entry((volatile pte_64model *)&page_root_table[3]);
-    pte_common_enable_user((volatile pte_64model *)&page_root_table[3]);
+    volatile pte_sv39 *root = current -> page_root;
+
+    //every task has a root table and ASID of its own,a new directory needs a new ASID as well
+    if(asid_bits)
+    {
+        cur_page_dir_table = dir_table;
+
+        if(pte_common_ppn_to_addr((volatile pte_64model *)&root[3]) != (ulong)dir_table)
+        {
+            pte_common_addr_to_ppn((volatile pte_64model *)&root[3],(ulong)dir_table);
+            current -> asid = 0;
+        }
+
+        switch_mm(current);
+        return;
+    }
+
+    //without ASIDs each hart has a root table,whose directory entry is changed for the task it runs
+    root = core_page_root[current_coreid()];
+    tlb_stat.switches++;
+
+    //a vfork() child runs on its parent's directory,the translations stay valid
+    if((cur_page_dir_table == dir_table) && root[3].v)
+    {
+        return;
+    }
+
+    cur_page_dir_table = dir_table;
+    pte_common_addr_to_ppn((volatile pte_64model *)&root[3],(ulong)dir_table);
+    pte_common_enable_entry((volatile pte_64model *)&root[3]);
+    pte_common_enable_user((volatile pte_64model *)&root[3]);
+    //only this hart loads the root table,the other one keeps the translations of its own task
     pte_refresh_tlb();
+    tlb_stat.all++;
 }
 
 void mepc_recover()
@@ -91,7 +182,8 @@ void interrupt_recover()
 {
     csr_define_common csr;
 
-    if(trap_from_interrupt == true)
+    //only a PLIC interrupt has a claim to complete,int_num is 0 for the CLINT ones
+    if((trap_from_interrupt == true) && trap_info.int_num)
     {
         timer[TIMER_DEVICE_0] -> channel[TIMER_CHANNEL_0].eoi = readl(&timer[TIMER_DEVICE_0] -> channel[TIMER_CHANNEL_0].eoi);
         readl(&timer[TIMER_DEVICE_0] -> channel[TIMER_CHANNEL_0].eoi);
@@ -110,24 +202,40 @@ void interrupt_recover()
 
 void output_stack_usage(ulong sp)
 {
-    printk("kernel stack usage:usage : %d,old_kernel_stack : %p,trap source : %s,cpl : %d\r\n",sp,old_kernel_stack,(trap_from_interrupt ? "interrupt" : "exception"),privilege_get_previous_level());
+    printk("kernel stack usage:usage : %d,old_kernel_stack : %p,trap source : %s,cpl : %d\r\n",sp,old_kernel_stack[current_coreid()],(trap_from_interrupt ? "interrupt" : "exception"),privilege_get_previous_level());
 }
 
 void kernel_stack_overflow(ulong sp)
 {
-    printk("kernel_stack_overflow!usage : %d,old_kernel_stack : %p,trap source : %s,cpl : %d\r\n",sp,old_kernel_stack,(trap_from_interrupt ? "interrupt" : "exception"),privilege_get_previous_level());
+    ulong id = current_coreid();
+
+    if(!kernel_stack_guard_ok(cur_kernel_stackbottom[id]))
+    {
+        printk("kernel stack guard zone overwritten,bottom : %p\r\n",cur_kernel_stackbottom[id]);
+    }
+
+    printk("kernel_stack_overflow!usage : %d,old_kernel_stack : %p,trap source : %s,cpl : %d\r\n",sp,old_kernel_stack[id],(trap_from_interrupt ? "interrupt" : "exception"),privilege_get_previous_level());
     while(1);
 }
 
-bool switch_to(int taskid)
+//The task may come back on another hart,so the hart is read again after switch_to_tss()
+bool switch_to(struct task_struct *next)
 {
     struct tss_struct *oldtss = &(current -> tss);
-    struct tss_struct *tss = &(task[taskid] -> tss);
+    struct tss_struct *tss = &(next -> tss);
+    int64_t taskid = next -> nr;
+    ulong id = current_coreid();
     trap_info_t oldtrapinfo;
+    volatile pte_sv39 *root;
     syslog_debug("switch_to","taskid = %d",taskid);
     stack_overflow_check();
 
-    if(current != task[taskid])
+    if(!kernel_stack_guard_ok(cur_kernel_stackbottom[id]))
+    {
+        kernel_stack_overflow(cur_kernel_stack[id] - get_sp());
+    }
+
+    if(current != next)
     {
         //syslog_print("switch to %d\r\n",taskid);
         //syslog_print("cur kernel stack1 = %p\r\n",cur_kernel_stack);
@@ -137,10 +245,12 @@ bool switch_to(int taskid)
         syslog_print("tss -> epc = %p\r\n",tss -> epc);*/
         oldtrapinfo = trap_info;
         oldtss -> epc = trap_info.newepc;
-        current = task[taskid];
-        old_kernel_stack = cur_kernel_stack;
-        cur_kernel_stack = kernel_stack[taskid];
-        cur_kernel_stackbottom = kernel_stackbottom[taskid];
+        tlb_batch_flush();
+        current = next;
+        old_kernel_stack[id] = cur_kernel_stack[id];
+        cur_kernel_stack[id] = kernel_stack[taskid];
+        cur_kernel_stackbottom[id] = kernel_stackbottom[taskid];
+        tlb_lazy_flush();
         set_page_dir(current -> page_dir_table);
         switch_to_tss(oldtss,tss);
         //syslog_print("cur kernel stack2 = %p\r\n",cur_kernel_stack);
@@ -149,13 +259,21 @@ bool switch_to(int taskid)
         //trap_info.newepc = tss -> epc;
         //syslog_print("newepc = %p\r\n",trap_info.newepc);
 
-        if(trap_info.newepc < USER_START_ADDR)
-        {
-            pte_common_enable_user((volatile pte_64model *)&page_root_table[2]);
-        }
-        else
+        //set_page_dir() may have kept the TLB,so a changed user bit needs a flush of its own
+        root = asid_bits ? current -> page_root : core_page_root[id];
+
+        if((trap_info.newepc < USER_START_ADDR) != root[2].u)
         {
-            pte_common_disable_user((volatile pte_64model *)&page_root_table[2]);
+            if(trap_info.newepc < USER_START_ADDR)
+            {
+                pte_common_enable_user((volatile pte_64model *)&root[2]);
+            }
+            else
+            {
+                pte_common_disable_user((volatile pte_64model *)&root[2]);
+            }
+
+            flush_tlb_all();
         }
 
         //set_page_dir(task[taskid] -> page_dir_table);
@@ -174,83 +292,336 @@ bool switch_to(int taskid)
     return true;
 }
 
-//'schedule()' is the scheduler function
-//Task 0 is the 'idle' task,which gets called when no other tasks can run.It can not be killed,and it cannot sleep.
-//The 'state' information in task[0] is never used.
-bool schedule()
+//The run queue.Runnable tasks wait in the active array on the level of their counter,a bitmap bit per non-empty level,
+//so the task with the highest counter is found without looking at the others.A task which used up its counter
+//goes to the expired array on the level of the counter it gets at the next recalculation.The recalculation
+//('counter = counter / 2 + priority' for every task) is then only a swap of the arrays:the tasks which sleep
+//through it catch up when they are woken.The running tasks and the idle tasks are never queued
+#define RUN_LEVELS 64
+
+struct run_array
 {
-    int i,next,c;
-    struct task_struct **p;
-    csr_define_common mstatus,mie;
+    ulong bitmap;
+    struct task_struct *head[RUN_LEVELS];//circular lists,head -> run_prev is the tail
+};
 
-    mstatus = csr_read(csr_mstatus);
-    mie = csr_read(csr_mie);
-    sysctl_disable_irq();
-    
-    //check alarm,wake up any interruptible tasks that have got a signal
-    for(p = &LAST_TASK;p > &FIRST_TASK;--p)
+static struct run_array run_arrays[2];
+static struct run_array *active = &run_arrays[0];
+static struct run_array *expired = &run_arrays[1];
+static ulong sched_epoch = 0;//recalculations so far
+struct sched_stat sched_stat;
+
+static inline int64_t run_level(int64_t counter)
+{
+    return (counter < 0) ? 0 : ((counter >= RUN_LEVELS) ? (RUN_LEVELS - 1) : counter);
+}
+
+static inline int64_t highest_level(ulong bitmap)
+{
+    int64_t level = 0;
+
+    if(bitmap >> 32)
     {
-        if(*p)
-        {
-            syslog_info("schedule","task %d checking...,task struct addr = %p",p - &FIRST_TASK,*p);
+        bitmap >>= 32;
+        level += 32;
+    }
 
-            if(((*p) -> alarm) && ((*p) -> alarm < jiffies))
-            {
-                (*p) -> signal |= (1 << (SIGALRM - 1));
-                (*p) -> alarm = 0;
-            }
+    if(bitmap >> 16)
+    {
+        bitmap >>= 16;
+        level += 16;
+    }
 
-            if((((*p) -> signal) & (~(_BLOCKABLE * (*p) -> blocked))) && ((*p) -> state == TASK_INTERRUPTIBLE))
-            {
-                (*p) -> state = TASK_RUNNING;
-            }
-        }
+    if(bitmap >> 8)
+    {
+        bitmap >>= 8;
+        level += 8;
     }
 
-    //this is the scheduler proper
-    while(1)
+    if(bitmap >> 4)
     {
-        c = -1;
-        next = 0;
-        i = NR_TASKS;
-        p = &task[NR_TASKS];
+        bitmap >>= 4;
+        level += 4;
+    }
 
-        while(--i)
-        {
-            if(!*--p)
-            {
-                continue;
-            }
+    if(bitmap >> 2)
+    {
+        bitmap >>= 2;
+        level += 2;
+    }
 
-            if(((*p) -> state == TASK_RUNNING) && ((*p) -> counter > c))
-            {
-                c = (*p) -> counter;
-                next = i;
-            }
+    return level + (bitmap >> 1);
+}
+
+static void run_array_add(struct run_array *array,struct task_struct *p,int64_t level)
+{
+    struct task_struct *head = array -> head[level];
+
+    if(head)
+    {
+        p -> run_next = head;
+        p -> run_prev = head -> run_prev;
+        head -> run_prev -> run_next = p;
+        head -> run_prev = p;
+    }
+    else
+    {
+        p -> run_next = p -> run_prev = p;
+        array -> head[level] = p;
+        array -> bitmap |= 1UL << level;
+    }
+
+    p -> run_array = array;
+    p -> run_level = level;
+}
+
+static void run_array_del(struct task_struct *p)
+{
+    struct run_array *array = p -> run_array;
+
+    if(p -> run_next == p)
+    {
+        array -> head[p -> run_level] = NULL;
+        array -> bitmap &= ~(1UL << p -> run_level);
+    }
+    else
+    {
+        p -> run_prev -> run_next = p -> run_next;
+        p -> run_next -> run_prev = p -> run_prev;
+
+        if(array -> head[p -> run_level] == p)
+        {
+            array -> head[p -> run_level] = p -> run_next;
         }
+    }
 
-        if(c)
+    p -> run_array = NULL;
+}
+
+//Apply the recalculations p has missed,the counter settles at 2 * priority - 1 after a few
+static void sched_catch_up(struct task_struct *p)
+{
+    ulong missed = sched_epoch - p -> run_epoch;
+    int64_t counter;
+
+    while(missed--)
+    {
+        counter = (p -> counter >> 1) + p -> priority;
+
+        if(counter == p -> counter)
         {
             break;
         }
 
-        for(p = &LAST_TASK;p > &FIRST_TASK;--p)
+        p -> counter = counter;
+    }
+
+    p -> run_epoch = sched_epoch;
+}
+
+//interrupts must be off
+static void enqueue_task(struct task_struct *p)
+{
+    if(p -> run_array || is_idle_task(p))
+    {
+        return;
+    }
+
+    sched_catch_up(p);
+
+    if(p -> counter > 0)
+    {
+        run_array_add(active,p,run_level(p -> counter));
+    }
+    else
+    {
+        run_array_add(expired,p,run_level(p -> priority));
+    }
+}
+
+//Make p runnable and queue it,safe from interrupt handlers
+void wake_up_process(struct task_struct *p)
+{
+    csr_define_common mstatus,mie;
+
+    mstatus = csr_read(csr_mstatus);
+    mie = csr_read(csr_mie);
+    sysctl_disable_irq();
+    p -> state = TASK_RUNNING;
+
+    //a task running on the other core is queued again when that core schedules
+    if(!task_running(p))
+    {
+        tick_restart(0);
+        enqueue_task(p);
+        smp_send_reschedule();
+    }
+
+    csr_write(csr_mie,mie);
+    csr_write(csr_mstatus,mstatus);
+}
+
+//Has p a signal which isn't blocked
+bool signal_pending(struct task_struct *p)
+{
+    return (p -> signal & (~(_BLOCKABLE & p -> blocked))) != 0;
+}
+
+//Called after a signal is posted to p,an interruptible sleep ends if the signal isn't blocked
+void signal_wake_up(struct task_struct *p)
+{
+    if((p -> state == TASK_INTERRUPTIBLE) && signal_pending(p))
+    {
+        wake_up_process(p);
+    }
+}
+
+//The alarm of a task went off
+void alarm_fn(struct timer_list *timer)
+{
+    struct task_struct *p = (struct task_struct *)timer -> data;
+
+    p -> alarm = 0;
+    p -> signal |= (1 << (SIGALRM - 1));
+    signal_wake_up(p);
+}
+
+//Set the alarm of the current task in jiffies,0 cancels it
+void set_alarm(int64_t alarm)
+{
+    current -> alarm = alarm;
+
+    if(alarm)
+    {
+        mod_timer(&current -> alarm_timer,alarm);
+    }
+    else
+    {
+        del_timer(&current -> alarm_timer);
+    }
+}
+
+//Is p the current task of some hart
+bool task_running(struct task_struct *p)
+{
+    ulong id;
+
+    for(id = 0;id < CORE_NUM;id++)
+    {
+        if(core_current[id] == p)
         {
-            if(*p)
-            {
-                (*p) -> counter = ((*p) -> counter >> 1) + (*p) -> priority;
-            }
+            return true;
         }
     }
 
+    return false;
+}
+
+//Is there a task waiting for a hart
+bool sched_runnable()
+{
+    return active -> bitmap || expired -> bitmap;
+}
+
+//'schedule()' is the scheduler function
+//Task 0 is the 'idle' task,which gets called when no other tasks can run.It can not be killed,and it cannot sleep.
+//The 'state' information in task[0] is never used.Every other core has an idle task of its own outside task[].
+//The policy is still the one of the counters:the runnable task with the highest counter runs,and when all of them
+//are 0,every counter is recalculated
+bool schedule()
+{
+    struct task_struct *next = idle_task[current_coreid()];
+    struct task_struct *p;
+    struct run_array *array;
+    csr_define_common mstatus,mie;
+    ulong start = core_get_cycle();
+
+    mstatus = csr_read(csr_mstatus);
+    mie = csr_read(csr_mie);
+    sysctl_disable_irq();
+
+    //a signal may have come in before current went to sleep
+    signal_wake_up(current);
+
+    //requeue current with its counter as it is now
+    if(current -> run_array)
+    {
+        run_array_del(current);
+    }
+
+    if(current -> state == TASK_RUNNING)
+    {
+        enqueue_task(current);
+    }
+
+    if((!active -> bitmap) && expired -> bitmap)
+    {
+        array = active;
+        active = expired;
+        expired = array;
+        sched_epoch++;
+        sched_stat.recalcs++;
+    }
+
+    if(active -> bitmap)
+    {
+        p = active -> head[highest_level(active -> bitmap)];
+        run_array_del(p);
+        sched_catch_up(p);
+        next = p;
+    }
+
+    //a task alone on core 0 needs no tick until its next event
+    if((!is_idle_task(next)) && (!sched_runnable()))
+    {
+        tick_stop(next);
+    }
+
+    sched_stat.calls++;
+    sched_stat.cycles += core_get_cycle() - start;
     bool r = switch_to(next);
     csr_write(csr_mie,mie);
     csr_write(csr_mstatus,mstatus);
     return r;
 }
 
+//for debug only
+void show_sched()
+{
+    struct task_struct **p;
+    ulong queued = 0,expired_tasks = 0;
+    ulong id;
+
+    for(p = &LAST_TASK;p > &FIRST_TASK;--p)
+    {
+        if(*p && (*p) -> run_array)
+        {
+            queued++;
+            expired_tasks += ((*p) -> run_array == expired);
+        }
+    }
+
+    printk("sched:%lu calls,%lu cycles each,%lu recalculations\r\n",sched_stat.calls,sched_stat.calls ? sched_stat.cycles / sched_stat.calls : 0,sched_stat.recalcs);
+    printk("sched:%lu timers run,%lu moved down the timer wheel\r\n",sched_stat.timers_run,sched_stat.timer_cascades);
+    printk("sched:%lu tasks queued,%lu of them expired\r\n",queued,expired_tasks);
+
+    for(id = 0;id < CORE_NUM;id++)
+    {
+        printk("sched:core %lu tick,%lu interrupts for %lu ticks,%lu interrupts avoided\r\n",id,sched_stat.tick_irqs[id],sched_stat.tick_ticks[id],
+               (sched_stat.tick_ticks[id] > sched_stat.tick_irqs[id]) ? (sched_stat.tick_ticks[id] - sched_stat.tick_irqs[id]) : 0);
+    }
+
+    printk("sched:tick stopped %lu times\r\n",sched_stat.tick_stops);
+}
+
 int64_t sys_pause()
 {
+    //the idle tasks free the page tables exit and exec left behind,and wait for work when there are none
+    if(is_idle_task(current) && (!drain_deferred_tables(DEFER_DRAIN_BATCH)))
+    {
+        cpu_idle_wait();
+    }
+
     current -> state = TASK_INTERRUPTIBLE;
     schedule();
     return 0;
@@ -265,7 +636,7 @@ void sleep_on(struct task_struct **p)
         return;
     }
 
-    if(current == &(init_task.task))
+    if(is_idle_task(current))
     {
         panic("task[0] trying to sleep");
     }
@@ -278,7 +649,7 @@ void sleep_on(struct task_struct **p)
     {
         if(tmp)
         {
-            tmp -> state = TASK_RUNNING;
+            wake_up_process(tmp);
         }
     }
 }
@@ -292,7 +663,7 @@ void interruptible_sleep_on(struct task_struct **p)
         return;
     }
 
-    if(current == &(init_task.task))
+    if(is_idle_task(current))
     {
         panic("task[0] trying to sleep");
     }
@@ -307,7 +678,7 @@ void interruptible_sleep_on(struct task_struct **p)
         {
             if((*p) && (*p != current))
             {
-                (**p).state = TASK_RUNNING;
+                wake_up_process(*p);
                 goto repeat;
             }
         }
@@ -316,7 +687,7 @@ void interruptible_sleep_on(struct task_struct **p)
 
     if(tmp)
     {
-        tmp -> state = TASK_RUNNING;
+        wake_up_process(tmp);
     }
 }
 
@@ -324,109 +695,451 @@ void wake_up(struct task_struct **p)
 {
     if(p && (*p))
     {
-        (**p).state = TASK_RUNNING;
+        wake_up_process(*p);
     }
 }
 
-#define TIME_REQUESTS 64
+//Timers are kept in a hierarchical wheel of TV_LEVELS levels of TV_SIZE slots.Level 0 has a slot for each of the
+//next TV_SIZE jiffies,level n one for each TV_SIZE^n jiffies further on.When level 0 wraps around,the next slot of
+//level 1 is emptied into the levels below,and so on up,so a timer moves down at most TV_LEVELS - 1 times.Adding,
+//cancelling and running a timer are O(1).A bitmap of the slots in use on each level,as in the run queue,
+//finds the next timer for the dynamic tick
+#define TV_BITS 6
+#define TV_SIZE (1UL << TV_BITS)//one bit of a ulong bitmap for each slot
+#define TV_MASK (TV_SIZE - 1)
+#define TV_LEVELS 5
+#define TIMER_EXPIRING (TV_LEVELS * TV_SIZE)//the timers being run,moved out of their slot first
+#define TIMER_MAX_DELAY ((1L << (TV_BITS * TV_LEVELS)) - 1)//about 124 days at HZ 100,longer delays are cut to it
+#define NO_TIMER 0x7FFFFFFFFFFFFFFFL
+
+static struct timer_list *timer_vec[TIMER_EXPIRING + 1];
+static ulong timer_bitmap[TV_LEVELS];
+static int64_t timer_jiffies = 0;//next jiffy whose timers run_timers() has to run
+static struct kmem_cache *timer_cachep;//timers of add_timer()
+
+void init_timer(struct timer_list *timer,void (*fn)(struct timer_list *timer),ulong data)
+{
+    timer -> expires = 0;
+    timer -> fn = fn;
+    timer -> data = data;
+    timer -> next = NULL;
+    timer -> prev = NULL;
+    timer -> slot = -1;
+}
 
-static struct timer_list
+//interrupts must be off
+static void timer_link(struct timer_list *timer,int64_t slot)
 {
-    int64_t jiffies;
-    void (*fn)();
-    struct timer_list *next;
-}timer_list[TIME_REQUESTS],*next_timer = NULL;
+    timer -> prev = NULL;
+    timer -> next = timer_vec[slot];
+
+    if(timer -> next)
+    {
+        timer -> next -> prev = timer;
+    }
+
+    timer_vec[slot] = timer;
+    timer -> slot = slot;
 
-void add_timer(int64_t jiffies,void (*fn)())
+    if(slot < TIMER_EXPIRING)
+    {
+        timer_bitmap[slot >> TV_BITS] |= 1UL << (slot & TV_MASK);
+    }
+}
+
+//interrupts must be off
+static void timer_unlink(struct timer_list *timer)
 {
-    struct timer_list *p;
+    int64_t slot = timer -> slot;
 
-    if(!fn)
+    if(timer -> prev)
     {
-        return;
+        timer -> prev -> next = timer -> next;
+    }
+    else
+    {
+        timer_vec[slot] = timer -> next;
+    }
+
+    if(timer -> next)
+    {
+        timer -> next -> prev = timer -> prev;
+    }
+
+    if((!timer_vec[slot]) && (slot < TIMER_EXPIRING))
+    {
+        timer_bitmap[slot >> TV_BITS] &= ~(1UL << (slot & TV_MASK));
+    }
+
+    timer -> next = NULL;
+    timer -> prev = NULL;
+    timer -> slot = -1;
+}
+
+//Put timer in the slot of its expiry,on the lowest level that reaches that far.A timer which is due
+//goes to the slot run next
+static void timer_enqueue(struct timer_list *timer)
+{
+    int64_t expires = timer -> expires;
+    int64_t delta = expires - timer_jiffies;
+    ulong level = 0;
+
+    if(delta < 0)
+    {
+        expires = timer_jiffies;
+        delta = 0;
+    }
+    else if(delta > TIMER_MAX_DELAY)
+    {
+        expires = timer_jiffies + TIMER_MAX_DELAY;
+        delta = TIMER_MAX_DELAY;
+    }
+
+    while((level < TV_LEVELS - 1) && (delta >> (TV_BITS * (level + 1))))
+    {
+        level++;
     }
 
+    timer_link(timer,level * TV_SIZE + ((expires >> (TV_BITS * level)) & TV_MASK));
+}
+
+//Start timer to go off once jiffies reach expires,a pending timer is moved
+void mod_timer(struct timer_list *timer,int64_t expires)
+{
+    csr_define_common mstatus,mie;
+
+    mstatus = csr_read(csr_mstatus);
+    mie = csr_read(csr_mie);
+    sysctl_disable_irq();
+
+    if(timer -> slot >= 0)
+    {
+        timer_unlink(timer);
+    }
+
+    timer -> expires = expires;
+    timer_enqueue(timer);
+    //core 0 may be waiting for a later event
+    tick_restart(0);
+    csr_write(csr_mie,mie);
+    csr_write(csr_mstatus,mstatus);
+}
+
+//Returns whether the timer was pending
+bool del_timer(struct timer_list *timer)
+{
+    bool pending;
+    csr_define_common mstatus,mie;
+
+    mstatus = csr_read(csr_mstatus);
+    mie = csr_read(csr_mie);
     sysctl_disable_irq();
 
-    if(jiffies <= 0)
+    if((pending = (timer -> slot >= 0)))
+    {
+        timer_unlink(timer);
+    }
+
+    csr_write(csr_mie,mie);
+    csr_write(csr_mstatus,mstatus);
+    return pending;
+}
+
+static void timer_call_once(struct timer_list *timer)
+{
+    void (*fn)() = (void (*)())timer -> data;
+
+    kmem_cache_free(timer_cachep,timer);
+    fn();
+}
+
+//Call fn once in delay jiffies,from the tick.The timer is freed once it has gone off
+int64_t add_timer(int64_t delay,void (*fn)())
+{
+    struct timer_list *timer;
+
+    if(!fn)
+    {
+        return -EINVAL;
+    }
+
+    if(delay <= 0)
     {
         fn();
+        return 0;
     }
-    else
+
+    if(!(timer = (struct timer_list *)kmem_cache_alloc(timer_cachep)))
+    {
+        return -ENOMEM;
+    }
+
+    init_timer(timer,timer_call_once,(ulong)fn);
+    mod_timer(timer,jiffies + delay);
+    return 0;
+}
+
+//Empty a slot of the upper levels into the levels below
+static void timer_cascade(int64_t slot)
+{
+    struct timer_list *timer;
+
+    while((timer = timer_vec[slot]))
+    {
+        timer_unlink(timer);
+        timer_enqueue(timer);
+        sched_stat.timer_cascades++;
+    }
+}
+
+//Run the timers which are due up to jiffies,with interrupts off.The timers of a slot are moved out of it first,
+//so that one which starts itself again for a time already passed runs at the next jiffy,not in a loop
+static void run_timers()
+{
+    struct timer_list *timer;
+    ulong level,index;
+
+    while(timer_jiffies <= jiffies)
     {
-        for(p = timer_list;p < timer_list + TIME_REQUESTS;p++)
+        index = timer_jiffies & TV_MASK;
+
+        for(level = 1;(!index) && (level < TV_LEVELS);level++)
         {
-            if(!p -> fn)
-            {
-                break;
-            }
+            index = (timer_jiffies >> (TV_BITS * level)) & TV_MASK;
+            timer_cascade(level * TV_SIZE + index);
         }
 
-        if(p >= timer_list + TIME_REQUESTS)
+        index = timer_jiffies & TV_MASK;
+
+        while((timer = timer_vec[index]))
         {
-            panic("No more time requests free");
+            timer_unlink(timer);
+            timer_link(timer,TIMER_EXPIRING);
         }
 
-        p -> fn = fn;
-        p -> jiffies = jiffies;
-        p -> next = next_timer;
-        next_timer = p;
+        timer_jiffies++;
 
-        while(p -> next && (p -> next -> jiffies < p -> jiffies))
+        while((timer = timer_vec[TIMER_EXPIRING]))
         {
-            p -> jiffies -= p -> next -> jiffies;
-            fn = p -> fn;
-            p -> next -> fn = fn;
-            jiffies = p -> jiffies;
-            p -> jiffies = p -> next -> jiffies;
-            p -> next -> jiffies = jiffies;
-            p = p -> next;
+            timer_unlink(timer);
+            sched_stat.timers_run++;
+            timer -> fn(timer);
         }
+    }
+}
 
-        jiffies = p -> jiffies;
+//The jiffy the next timer may go off at.Only level 0 is looked at:if it wraps around before its next timer,
+//the cascade then may bring one down and is taken as the next event
+static int64_t timer_next_expiry()
+{
+    ulong index = timer_jiffies & TV_MASK;
+    ulong bits = timer_bitmap[0] >> index;
+    ulong level;
 
-        while(p -> next)
+    if(bits)
+    {
+        return timer_jiffies + __builtin_ctzl(bits);
+    }
+
+    for(level = 0;level < TV_LEVELS;level++)
+    {
+        if(timer_bitmap[level])
         {
-            p -> next -> jiffies -= jiffies;
-            p = p -> next;
+            return timer_jiffies + (TV_SIZE - index);
         }
     }
 
-    sysctl_enable_irq();
+    return NO_TIMER;
 }
 
-void do_timer()
+//Dynamic tick.jiffies follow the CLINT time,so one tick interrupt may stand for several ticks.When core 0 is idle
+//or has a single task to run,TIMER_DEVICE_0 is set to go off once at the next timer,alarm or end of the time slice
+//instead of every 10ms,and jiffies are caught up when it goes off or the kernel is entered.Any new event or
+//a second runnable task puts the periodic tick back.An idle core 1 turns its CLINT tick off
+#define TICK_NSEC (1000000000UL / HZ)
+#define TICK_STOP_MAX HZ//longest one-shot interval in ticks,TIMER_DEVICE_0 counts 32 bits
+
+ulong tick_cycles;//CLINT cycles per tick
+static ulong last_tick;//CLINT time of jiffies
+static bool tick_stopped[CORE_NUM];
+static ulong tick_stop_time[CORE_NUM];//CLINT time the tick of a core other than 0 was turned off
+
+static void tick_program(ulong ticks)
 {
-    privilege_level cpl = privilege_get_previous_level();
-    syslog_debug("do_timer","cpl = %d",cpl);
+    timer_set_enable(TIMER_DEVICE_0,TIMER_CHANNEL_0,0);
+    timer_set_interval(TIMER_DEVICE_0,TIMER_CHANNEL_0,ticks * TICK_NSEC);
+    timer_set_enable(TIMER_DEVICE_0,TIMER_CHANNEL_0,1);
+}
 
-    if(cpl == privilege_level_user)
+//Back to a periodic tick from now on.last_tick is put half a tick behind,so that the interrupts fall in the middle
+//of the ticks and a little drift between the two clocks never makes one count 0 or 2 ticks
+static void tick_periodic()
+{
+    tick_program(1);
+    last_tick = clint -> mtime - (tick_cycles >> 1);
+}
+
+//Bring jiffies up to the CLINT time,returns the ticks that passed.The timers that are due are left to do_timer(),
+//the one-shot tick goes off for the first of them anyway
+static ulong tick_advance()
+{
+    ulong ticks = (clint -> mtime - last_tick) / tick_cycles;
+
+    if(!ticks)
     {
-        current -> utime++;
+        return 0;
     }
-    else
+
+    last_tick += ticks * tick_cycles;
+    jiffies += ticks;
+    sched_stat.tick_ticks[0] += ticks;
+    return ticks;
+}
+
+//Ticks until the next timer,alarms included
+static int64_t tick_next_event()
+{
+    int64_t expires = timer_next_expiry();
+
+    return ((expires == NO_TIMER) || (expires - jiffies > TICK_STOP_MAX)) ? TICK_STOP_MAX : (expires - jiffies);
+}
+
+//Called with interrupts off when this core is going idle,or by schedule() when next is the only runnable task
+void tick_stop(struct task_struct *next)
+{
+    ulong id = current_coreid();
+    int64_t ticks;
+
+    if(tick_stopped[id])
     {
-        syslog_debug("do_timer","mepc = %p",csr_read(csr_mepc).mepc.value);
-        current -> stime++;
+        return;
     }
 
-    if(next_timer)
+    if(id == 0)
     {
-        next_timer -> jiffies--;
+        tick_advance();
+        ticks = tick_next_event();
+
+        if((!is_idle_task(next)) && (next -> counter < ticks))
+        {
+            ticks = next -> counter;
+        }
 
-        while(next_timer && next_timer -> jiffies <= 0)
+        if(ticks < 2)
         {
-            void (*fn)();
-            fn = next_timer -> fn;
-            next_timer -> fn = NULL;
-            next_timer = next_timer -> next;
-            fn();
+            return;
         }
+
+        tick_program(ticks);
+    }
+    else
+    {
+        //the other cores have no events of their own
+        if(!is_idle_task(next))
+        {
+            return;
+        }
+
+        clint -> mtimecmp[id] = ~0UL;
+        tick_stop_time[id] = clint -> mtime;
+    }
+
+    tick_stopped[id] = true;
+    sched_stat.tick_stops++;
+}
+
+//Put the tick of core id back,0 or the core running this with interrupts off.Core 0 is restarted by the
+//events which may come before the one it waits for,and the others when they stop being idle
+void tick_restart(ulong id)
+{
+    ulong ticks;
+
+    if(!tick_stopped[id])
+    {
+        return;
+    }
+
+    if(id == 0)
+    {
+        tick_update();
+        tick_stopped[0] = false;
+        tick_periodic();
+    }
+    else
+    {
+        tick_stopped[id] = false;
+        ticks = (clint -> mtime - tick_stop_time[id]) / tick_cycles;
+        sched_stat.tick_ticks[id] += ticks;
+        smp_stat.ticks[id] += ticks;
+        smp_stat.idle_ticks[id] += ticks;
+        clint -> mtimecmp[id] = clint -> mtime + tick_cycles;
+    }
+}
+
+//Catch jiffies up on a kernel entry while the tick of core 0 is stopped,the time went to the task running there
+void tick_update()
+{
+    struct task_struct *p = core_current[0];
+    ulong ticks;
+
+    if((!tick_stopped[0]) || (!(ticks = tick_advance())))
+    {
+        return;
+    }
+
+    smp_stat.ticks[0] += ticks;
+
+    if(is_idle_task(p))
+    {
+        smp_stat.idle_ticks[0] += ticks;
+    }
+    else
+    {
+        p -> utime += ticks;
+        p -> counter = (p -> counter > (int64_t)ticks) ? (p -> counter - ticks) : 0;
+    }
+}
+
+//The tick of core 0,which keeps the time for both cores
+void do_timer()
+{
+    ulong ticks = tick_advance();
+
+    sched_stat.tick_irqs[0]++;
+    run_timers();
+
+    //a one-shot tick went off
+    if(tick_stopped[0])
+    {
+        tick_stopped[0] = false;
+        tick_periodic();
+    }
+
+    update_process_times(ticks);
+}
+
+//Charge ticks to the task running on this hart,and schedule if its time slice is used up
+void update_process_times(ulong ticks)
+{
+    privilege_level cpl = privilege_get_previous_level();
+    ulong id = current_coreid();
+    syslog_debug("do_timer","cpl = %d",cpl);
+    smp_stat.ticks[id] += ticks;
+    smp_stat.idle_ticks[id] += is_idle_task(current) ? ticks : 0;
+
+    if(cpl == privilege_level_user)
+    {
+        current -> utime += ticks;
+    }
+    else
+    {
+        syslog_debug("do_timer","mepc = %p",csr_read(csr_mepc).mepc.value);
+        current -> stime += ticks;
     }
 
     syslog_debug("do_timer","counter = %d",current -> counter);
 
-    if((--(current -> counter)) > 0)
+    if((current -> counter -= ticks) > 0)
     {
         return;
     }
@@ -453,7 +1166,7 @@ int64_t sys_alarm(long seconds)
         old = (old - jiffies) / HZ;
     }
 
-    current -> alarm = (seconds > 0) ? (jiffies + HZ * seconds) : 0;
+    set_alarm((seconds > 0) ? (jiffies + HZ * seconds) : 0);
     return old;
 }
 
@@ -514,7 +1227,9 @@ void sched_init()
     task -> priority = 15;
     task -> father = -1;
     task -> page_dir_table = init_task_page_dir_table;
+    task -> page_root = page_root_table;
     pte_common_init(init_task_page_dir_table,PAGE_DIR_TABLE_NUM);
+    asid_init();
     task -> code_base = 0xC0000000;
     task -> data_base = task -> code_base;
     task -> code_limit = 640 * 1024;
@@ -522,10 +1237,39 @@ void sched_init()
     regs_backup(task -> tss.regs,task -> tss.fregs);
     task -> tss.regs[reg_sp] = ((ulong)init_task.stack) + PAGE_SIZE;
     task -> tty = -1;
-    cur_kernel_stack = kernel_stack[0];
+    init_timer(&task -> alarm_timer,alarm_fn,(ulong)task);
+    cur_kernel_stack[0] = kernel_stack[0];
+    cur_kernel_stackbottom[0] = kernel_stackbottom[0];
+    kernel_stack_guard_init(0);
 
+    if(!(timer_cachep = kmem_cache_create("timer_list",sizeof(struct timer_list),NULL)))
+    {
+        panic("sched_init:can't create timer cache");
+    }
+
+    tick_cycles = clint_timer_get_freq() / HZ;
+    hrtimers_init();
     timer_init(TIMER_DEVICE_0);
-    timer_set_interval(TIMER_DEVICE_0,TIMER_CHANNEL_0,10000000UL);
     timer_irq_register(TIMER_DEVICE_0,TIMER_CHANNEL_0,0,PLIC_NUM_PRIORITIES,timer_interrupt,NULL);
-    timer_set_enable(TIMER_DEVICE_0,TIMER_CHANNEL_0,1);
-}
\ No newline at end of file
+    tick_periodic();
+}
+//Set up the idle task of core id as a copy of task 0 at boot,on the same address space.
+//Its kernel stack comes after those of task[]
+struct task_struct *idle_task_init(ulong id)
+{
+    union task_union *u = &core_idle_task[id - 1];
+    struct task_struct *p = &u -> task;
+    int64_t nr = NR_TASKS + id - 1;
+
+    *p = init_task.task;
+    p -> nr = nr;
+    p -> asid = 0;
+    kernel_stack[nr] = ((ulong)u -> stack) + PAGE_SIZE + KERNEL_STACK_SIZE;
+    kernel_stackbottom[nr] = ((ulong)u -> stack) + PAGE_SIZE;
+    kernel_stack_guard_init(nr);
+    p -> tss.regs[reg_sp] = ((ulong)u -> stack) + PAGE_SIZE;
+    init_timer(&p -> alarm_timer,alarm_fn,(ulong)p);
+    idle_task[id] = p;
+    core_current[id] = p;
+    return p;
+}
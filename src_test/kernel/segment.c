@@ -1,4 +1,5 @@
 #include "common.h"
+#include "linux/mm.h"
 
 static ulong fs_is_kernel = 0;
 
@@ -48,27 +49,27 @@ extern inline uint64_t get_fs_64long(const uint64_t *addr)
 extern inline void put_fs_byte(uint8_t val,uint8_t *addr)
 {
 	ulong addr_t = (ulong)addr;
-	(!fs_is_kernel) ? user_addr_to_kernel(&addr_t) : 0;
+	(!fs_is_kernel) ? user_addr_to_kernel_write(&addr_t) : 0;
 	*((uint8_t *)addr_t) = val;
 }
 
 extern inline void put_fs_word(uint16_t val,uint16_t * addr)
 {
 	ulong addr_t = (ulong)addr;
-	(!fs_is_kernel) ? user_addr_to_kernel(&addr_t) : 0;
+	(!fs_is_kernel) ? user_addr_to_kernel_write(&addr_t) : 0;
 	*((uint16_t *)addr_t) = val;
 }
 
 extern inline void put_fs_long(uint32_t val,uint32_t * addr)
 {
 	ulong addr_t = (ulong)addr;
-	(!fs_is_kernel) ? user_addr_to_kernel(&addr_t) : 0;
+	(!fs_is_kernel) ? user_addr_to_kernel_write(&addr_t) : 0;
 	*((uint32_t *)addr_t) = val;
 }
 
 extern inline void put_fs_64long(uint64_t val,uint64_t * addr)
 {
 	ulong addr_t = (ulong)addr;
-	(!fs_is_kernel) ? user_addr_to_kernel(&addr_t) : 0;
+	(!fs_is_kernel) ? user_addr_to_kernel_write(&addr_t) : 0;
 	*((uint64_t *)addr_t) = val;
 }
\ No newline at end of file
@@ -5,7 +5,6 @@
 #include "signal.h"
 
 volatile void do_exit(int error_code);
-extern trap_info_t trap_info;
 
 //signal get mask
 int sys_sgetmask()
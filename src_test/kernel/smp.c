@@ -0,0 +1,211 @@
+#include "common.h"
+#include "linux/config.h"
+#include "linux/sched.h"
+#include "linux/kernel.h"
+#include "linux/mm.h"
+
+//Both cores run tasks.The kernel is entered by one core at a time:a trap from user mode takes kernel_lock and
+//the return to user mode gives it back,so everything behind it still runs as on a single cpu.An interrupt taken
+//in the kernel,a sleep or a task switch keep the lock with the core,a task may come back on the other one.
+//Core 0 takes the device interrupts and keeps jiffies,core 1 has a CLINT tick of its own for the time slices.
+//The cores send each other a software interrupt to flush TLB entries and to wake an idle core for a new task
+
+extern ulong cur_kernel_stack[CORE_NUM];
+extern ulong cur_kernel_stackbottom[CORE_NUM];
+
+static spinlock_t kernel_lock = SPINLOCK_INIT;
+bool core_online[CORE_NUM];
+struct smp_stat smp_stat;
+static privilege_targetfunc core1_idle;
+
+//Take the CLINT interrupts,software and timer,on this core
+static void core_enable_clint()
+{
+    csr_define_common csr = csr_read(csr_mie);
+
+    csr.mie.msie = 1;
+    csr.mie.mtie = 1;
+    csr_write(csr_mie,csr);
+}
+
+static void core_set_mie(bool enable)
+{
+    csr_define_common csr = csr_read(csr_mstatus);
+
+    csr.mstatus.mie = bool_to_bit(enable);
+    csr_write(csr_mstatus,csr);
+}
+
+void lock_kernel()
+{
+    if(!spinlock_trylock(&kernel_lock))
+    {
+        return;
+    }
+
+    smp_stat.lock_waits[current_coreid()]++;
+
+    //the core holding the lock may be waiting for this one to flush its TLB or to finish a job
+    while(spinlock_trylock(&kernel_lock))
+    {
+        tlb_shootdown_answer();
+        offload_run();
+    }
+
+    tick_update();
+}
+
+void unlock_kernel()
+{
+    spinlock_unlock(&kernel_lock);
+}
+
+//A task became runnable,wake the idle cores
+void smp_send_reschedule()
+{
+    ulong id,self = current_coreid();
+
+    for(id = 0;id < CORE_NUM;id++)
+    {
+        if((id != self) && core_online[id] && is_idle_task(core_current[id]))
+        {
+            clint_ipi_send(id);
+        }
+    }
+}
+
+//Software interrupt from the other core,taken before the kernel lock
+void smp_ipi_interrupt()
+{
+    ulong id = current_coreid();
+
+    clint_ipi_clear(id);
+    smp_stat.ipis[id]++;
+    tlb_shootdown_answer();
+    offload_run();
+}
+
+//The tick of the cores other than core 0
+void smp_timer_interrupt()
+{
+    ulong id = current_coreid();
+
+    clint -> mtimecmp[id] = clint -> mtime + tick_cycles;
+    sched_stat.tick_irqs[id]++;
+    sched_stat.tick_ticks[id]++;
+    update_process_times(1);
+}
+
+//Called by the idle task with the kernel lock held.Waits with the lock given up and the tick stopped until there
+//is a task to run,the interrupts which come in meanwhile are taken once the lock is back.Core 1 runs offloaded jobs
+//meanwhile
+void cpu_idle_wait()
+{
+    csr_define_common mstatus;
+    ulong id = current_coreid();
+
+    mstatus = csr_read(csr_mstatus);
+    core_set_mie(false);
+
+    while(!sched_runnable())
+    {
+        zero_pool_refill();
+        tick_stop(current);
+        unlock_kernel();
+        offload_run();
+        asm volatile("wfi");
+        lock_kernel();
+        tick_restart(id);
+        offload_reap();
+        core_set_mie(true);
+        core_set_mie(false);
+    }
+
+    csr_write(csr_mstatus,mstatus);
+}
+
+//Leave the kernel for the idle task of this core.Interrupts are off until it runs in user mode,
+//where they are always taken,so none comes in while the kernel isn't locked
+void smp_enter_user(privilege_targetfunc idle)
+{
+    core_set_mie(false);
+    unlock_kernel();
+    privilege_to_user(idle);
+}
+
+static int core1_main(void *ctx)
+{
+    ulong id = current_coreid();
+
+    core_init();
+    //nothing is routed to this core in the PLIC,the devices interrupt core 0
+    plic_init();
+    clint_ipi_clear(id);
+    lock_kernel();
+    cur_kernel_stack[id] = kernel_stack[current -> nr];
+    cur_kernel_stackbottom[id] = kernel_stackbottom[current -> nr];
+
+    //with ASIDs set_page_dir() loads the root table of the task
+    if(!asid_bits)
+    {
+        pte_set_root_page_table((volatile pte_64model *)core_page_root[id]);
+    }
+
+    set_page_dir(current -> page_dir_table);
+    pte_entry_sv39();
+    clint -> mtimecmp[id] = clint -> mtime + tick_cycles;
+    core_enable_clint();
+    sysctl_enable_irq();
+    core_online[id] = true;
+    printk("smp:core %lu online\r\n",id);
+    smp_enter_user(core1_idle);
+    return 0;
+}
+
+//Called by core 0 at boot,which holds the kernel lock from here until it goes to user mode.
+//Core 1 is started with an idle task of its own running idle in user mode,as task 0 runs user_main()
+void smp_init(privilege_targetfunc idle)
+{
+    lock_kernel();
+    core_online[0] = true;
+
+#ifdef CONFIG_SMP
+    //without ASIDs the tasks share the root table of the hart they run on,core 1 gets a copy of core 0's
+    if(!asid_bits)
+    {
+        if(!(core_page_root[1] = (volatile pte_sv39 *)get_free_page()))
+        {
+            printk("smp:no memory for the root table of core 1,it stays parked\r\n");
+            return;
+        }
+
+        memcpy((void *)core_page_root[1],(void *)page_root_table,sizeof(page_root_table));
+        pte_common_init((volatile pte_64model *)&core_page_root[1][3],1);
+    }
+
+    //tasks move between the cores with the mie they trapped with,so core 0 takes the same interrupts
+    //as core 1.Its CLINT timer is left to the high resolution timers
+    core_enable_clint();
+    core1_idle = idle;
+    idle_task_init(1);
+    register_core1(core1_main,NULL);
+#else
+    offload_init();
+#endif
+}
+
+//for debug only
+void show_smp()
+{
+    ulong id;
+
+    for(id = 0;id < CORE_NUM;id++)
+    {
+        if(core_online[id])
+        {
+            printk("smp:core %lu,%lu ticks,%lu idle,%lu waits for the kernel lock,%lu ipis\r\n",id,smp_stat.ticks[id],smp_stat.idle_ticks[id],smp_stat.lock_waits[id],smp_stat.ipis[id]);
+        }
+    }
+
+    printk("smp:%lu tlb shootdowns,%lu left to an idle core\r\n",smp_stat.shootdowns,smp_stat.lazy_flushes);
+}
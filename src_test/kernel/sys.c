@@ -1,5 +1,6 @@
 #include "common.h"
 #include "errno.h"
+#include "unistd.h"
 #include "linux/sched.h"
 #include "linux/tty.h"
 #include "linux/kernel.h"
@@ -202,7 +203,7 @@ int64_t sys_times(struct tms *tbuf)
 
 int64_t sys_brk(ulong end_data_seg)
 {
-    if((end_data_seg >= current -> end_code) && (end_data_seg < (current -> start_stack - 16384)))
+    if((end_data_seg >= current -> end_code) && (end_data_seg < (current -> start_stack - 16384)) && vma_set_brk(end_data_seg))
     {
         current -> brk = end_data_seg;
     }
@@ -308,6 +309,82 @@ int64_t sys_umask(int mask)
 
 int64_t sys_debug(ulong p)
 {
-    syslog_print("sys_debug:%d\r\n",p);
+    switch(p)
+    {
+        case DEBUG_SHOW_MEM:
+            calc_mem();
+            break;
+
+        case DEBUG_SHOW_SWAP:
+            show_swap();
+            break;
+
+        case DEBUG_SHOW_SLAB:
+            show_slab();
+            break;
+
+        //returns the pages of the caller moved into the swap pool
+        case DEBUG_SWAP_OUT:
+            if(!suser())
+            {
+                return -EPERM;
+            }
+
+            return swap_out_task(current);
+
+        //these change the paging of every task
+        case DEBUG_MEGAPAGE_ON:
+        case DEBUG_MEGAPAGE_OFF:
+            if(!suser())
+            {
+                return -EPERM;
+            }
+
+            megapage_enable = (p == DEBUG_MEGAPAGE_ON);
+            break;
+
+        case DEBUG_PGTABLE_SHARE_ON:
+        case DEBUG_PGTABLE_SHARE_OFF:
+            if(!suser())
+            {
+                return -EPERM;
+            }
+
+            pgtable_share_enable = (p == DEBUG_PGTABLE_SHARE_ON);
+            break;
+
+        case DEBUG_SHOW_VMA:
+            show_vma();
+            break;
+
+        case DEBUG_SHOW_TASK:
+            show_stat();
+            break;
+
+        case DEBUG_SHOW_SCHED:
+            show_sched();
+            show_hrtimer();
+            break;
+
+        case DEBUG_SCHED_RESET:
+            if(!suser())
+            {
+                return -EPERM;
+            }
+
+            memset(&sched_stat,0,sizeof(sched_stat));
+            memset(&hrtimer_stat,0,sizeof(hrtimer_stat));
+            break;
+
+        case DEBUG_SHOW_SMP:
+            show_smp();
+            show_offload();
+            break;
+
+        default:
+            syslog_print("sys_debug:%d\r\n",p);
+            break;
+    }
+
     return 0;
 }
\ No newline at end of file
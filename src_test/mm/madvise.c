@@ -0,0 +1,128 @@
+#include "common.h"
+#include "errno.h"
+#include "fcntl.h"
+#include "sys/stat.h"
+#include "sys/mman.h"
+#include "linux/sched.h"
+#include "linux/kernel.h"
+#include "linux/mm.h"
+#include "linux/fs.h"
+
+//madvise() and posix_fadvise() hints.
+//The paging hints apply to every area the range touches,areas are not split for them.
+//The file hints steer read-ahead in file_read() and the buffer cache
+
+#define MADV_READ_FLAGS (VM_SEQ_READ | VM_RAND_READ)
+
+//Start reading the file blocks behind [start,end),text and data areas carry the executable
+static void madvise_willneed(struct vm_area_struct *vma,ulong start,ulong end)
+{
+    if(vma -> vm_inode)
+    {
+        inode_readahead(vma -> vm_inode,(vma -> vm_offset + start - vma -> vm_start) / BLOCK_SIZE,(end - start + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    }
+}
+
+int64_t sys_madvise(ulong addr,ulong len,int advice)
+{
+    struct vm_area_struct *vma;
+    ulong start,end;
+    bool found = false;
+
+    len = (len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    if((addr & (PAGE_SIZE - 1)) || (addr + len < addr) || (advice < MADV_NORMAL) || (advice > MADV_DONTNEED))
+    {
+        return -EINVAL;
+    }
+
+    //locked pages must stay where they are
+    if((advice == MADV_DONTNEED) && current -> mlock)
+    {
+        return -EINVAL;
+    }
+
+    for(vma = current -> mmap;vma && (vma -> vm_start < addr + len);vma = vma -> vm_next)
+    {
+        if(vma -> vm_end <= addr)
+        {
+            continue;
+        }
+
+        found = true;
+        start = (addr > vma -> vm_start) ? addr : vma -> vm_start;
+        end = (addr + len < vma -> vm_end) ? addr + len : vma -> vm_end;
+
+        switch(advice)
+        {
+            case MADV_NORMAL:
+                vma -> vm_flags &= ~MADV_READ_FLAGS;
+                break;
+
+            case MADV_RANDOM:
+                vma -> vm_flags = (vma -> vm_flags & ~MADV_READ_FLAGS) | VM_RAND_READ;
+                break;
+
+            case MADV_SEQUENTIAL:
+                vma -> vm_flags = (vma -> vm_flags & ~MADV_READ_FLAGS) | VM_SEQ_READ;
+                break;
+
+            case MADV_WILLNEED:
+                madvise_willneed(vma,start,end);
+                break;
+
+            case MADV_DONTNEED:
+                zap_page_range(start,end - start);
+                break;
+        }
+    }
+
+    return found ? 0 : -ENOMEM;
+}
+
+int64_t sys_fadvise64(int fd,ulong offset,ulong len,int advice)
+{
+    struct file *f;
+    struct m_inode *inode;
+    ulong block,count;
+
+    if((fd < 0) || (fd >= NR_OPEN) || (!(f = current -> filp[fd])))
+    {
+        return -EBADF;
+    }
+
+    if((!(inode = f -> f_inode)) || (!S_ISREG(inode -> i_mode)))
+    {
+        return -ESPIPE;
+    }
+
+    //a length of 0 means up to the end of file
+    len = len ? len : ((offset < inode -> i_size) ? inode -> i_size - offset : 0);
+    block = offset / BLOCK_SIZE;
+    count = (offset + len + BLOCK_SIZE - 1) / BLOCK_SIZE - block;
+
+    switch(advice)
+    {
+        case POSIX_FADV_NORMAL:
+        case POSIX_FADV_RANDOM:
+        case POSIX_FADV_SEQUENTIAL:
+            f -> f_advice = advice;
+            break;
+
+        case POSIX_FADV_WILLNEED:
+            inode_readahead(inode,block,count);
+            break;
+
+        case POSIX_FADV_DONTNEED:
+            inode_drop_buffers(inode,block,count);
+            break;
+
+        case POSIX_FADV_NOREUSE:
+            break;
+
+        default:
+            return -EINVAL;
+    }
+
+    return 0;
+}
@@ -2,18 +2,18 @@
 #include "linux/kernel.h"
 #include "linux/mm.h"
 #include "linux/sched.h"
+#include "linux/config.h"
+#include "linux/fs.h"
 #include "signal.h"
 
 volatile void do_exit(int code);
 
-static inline volatile void oom()
+volatile void oom()
 {
     printk("out of memory\r\n");
     do_exit(SIGSEGV);
 }
 
-#define invalidate pte_refresh_tlb
-
 
 #define MAP_NR(addr) (((addr) - LOW_MEM) >> PAGING_SHIFT)//Address maps to page id
 #define USED 100//paging is used flag
@@ -25,130 +25,538 @@ static inline volatile void oom()
 
 static ulong HIGH_MEMORY = 0;//Memory high address
 
-static ulong inituseraddr = 0UL;
-static ulong lastuseraddr = 0UL;
-static ulong lastkerneladdr = 0UL;
-static ulong traned = false;
+//Read faults on anonymous memory map this page read-only,the first write copies it through do_wp_page().
+//It lies below LOW_MEM,so it has no mem_map count and is never freed or swapped.
+static ulong empty_zero_page[PAGE_SIZE / sizeof(ulong)] __attribute__((aligned(PAGE_SIZE)));
+#define ZERO_PAGE ((ulong)empty_zero_page)
+
+struct zero_page_stat zero_page_stat;
+
+//Copy between kernel memory and user memory one user page at a time,every page is translated on its own.
+//Writes go through user_addr_to_kernel_write(),so copy-on-write pages are split and the dirty bit is set.
+static void mem_copy_user(ulong kerneladdr,ulong useraddr,ulong size,bool write)
+{
+    ulong n,addr;
+
+    while(size > 0)
+    {
+        n = PAGING_SIZE - (useraddr & (PAGING_SIZE - 1));
+        n = (n > size) ? size : n;
+        addr = useraddr;
+
+        if(write)
+        {
+            if(!user_addr_to_kernel_write(&addr))
+            {
+                return;
+            }
+
+            memcpy((void *)addr,(void *)kerneladdr,n);
+        }
+        else
+        {
+            if(!user_addr_to_kernel(&addr))
+            {
+                return;
+            }
+
+            memcpy((void *)kerneladdr,(void *)addr,n);
+        }
+
+        kerneladdr += n;
+        useraddr += n;
+        size -= n;
+    }
+}
 
-extern trap_info_t trap_info;
+void mem_copy_from_kernel(ulong fromaddr,ulong toaddr,ulong size)
+{
+    mem_copy_user(fromaddr,toaddr,size,true);
+}
 
-void page_transform_start()
+void mem_copy_to_kernel(ulong fromaddr,ulong toaddr,ulong size)
 {
-    traned = false;
+    mem_copy_user(toaddr,fromaddr,size,false);
 }
 
-bool page_transform_addr(ulong *addr)
+void copy_page(ulong from,ulong to)
 {
-    if((traned == false) || ((GET_PAGE_ID(*addr) != GET_PAGE_ID(lastkerneladdr))))
+    ulong i;
+
+    for(i = 0;i < PAGING_SIZE;i += sizeof(ulong))
     {
-        traned = true;
-        lastuseraddr = *addr - lastkerneladdr + lastuseraddr;
-        *addr = lastuseraddr;
-        bool r = user_addr_to_kernel(&addr);
-        lastkerneladdr = *addr;
-        return r;
+        *(ulong *)(to + i) = *(ulong *)(from + i);
     }
+}
+
+static uint8_t mem_map[PAGING_PAGES] = {0,};
+
+struct mem_zone
+{
+    const char *name;
+    ulong start,end;//empty until the zone is given to the allocator
+};
+
+//allocations try the zones in this order,so the AI SRAM fills up last
+static struct mem_zone mem_zone[NR_ZONES] = {{"normal",0,0},{"ai",0,0}};
+
+//2MB leaf entries in page_dir_table,used for anonymous memory when a whole aligned block is inside the heap
+bool megapage_enable = true;
+struct megapage_stat megapage_stat;
+
+//fork shares page tables write-protected,mem_map of the table page counts the directories using it
+bool pgtable_share_enable = true;
+struct pgtable_stat pgtable_stat;
+
+//TLB shootdown.A single changed entry flushes its own address,an operation on many entries between
+//tlb_batch_start() and tlb_batch_end() flushes once at the end.The kernel walks user page tables in software,
+//so a deferred flush only has to be done before the task is back in user mode.The batch belongs to the task:
+//one which sleeps inside it,e.g. in iput(),flushes in switch_to() first,so that no other task runs meanwhile
+//with stale entries,and the flushes of other tasks are never deferred
+#define TLB_RANGE_PAGES 8//beyond this a range is flushed as a whole
+
+struct tlb_stat tlb_stat;
+ulong xip_pages = 0;
+
+//Flushes reach the other core as well.A core running a task is interrupted and flushes before the sender goes on,
+//it answers while it waits for the kernel lock too.An idle core only notes that its TLB is stale and flushes it
+//as a whole before it switches to a task
+#define SHOOTDOWN_PAGE 1
+#define SHOOTDOWN_ALL 2
+#define SHOOTDOWN_ASID 3//the ASID generation moved on,the running task needs a new ASID
+
+static struct tlb_shootdown
+{
+    volatile ulong type;//set back to 0 once done
+    volatile ulong address;
+    volatile bool stale;
+}tlb_shootdown[CORE_NUM];
+
+static void flush_tlb_others(ulong type,ulong address)
+{
+    ulong id,self = current_coreid();
+
+    for(id = 0;id < CORE_NUM;id++)
+    {
+        if((id == self) || (!core_online[id]))
+        {
+            continue;
+        }
+
+        if(is_idle_task(core_current[id]))
+        {
+            tlb_shootdown[id].stale = true;
+            smp_stat.lazy_flushes++;
+            continue;
+        }
+
+        tlb_shootdown[id].address = address;
+        mb();
+        tlb_shootdown[id].type = type;
+        clint_ipi_send(id);
+
+        while(tlb_shootdown[id].type);
 
+        smp_stat.shootdowns++;
+    }
+}
+
+//Do the flush the other core asked for,if there is one
+void tlb_shootdown_answer()
+{
+    struct tlb_shootdown *s = &tlb_shootdown[current_coreid()];
+
+    switch(s -> type)
+    {
+        case 0:
+            return;
+
+        case SHOOTDOWN_PAGE:
+            pte_refresh_tlb_addr(s -> address);
+            break;
+
+        case SHOOTDOWN_ASID:
+            pte_refresh_tlb();
+            switch_mm(current);
+            break;
+
+        default:
+            pte_refresh_tlb();
+            break;
+    }
+
+    mb();
+    s -> type = 0;
+}
+
+//Called by switch_to(),the flushes missed while the core was idle are made up for here
+void tlb_lazy_flush()
+{
+    struct tlb_shootdown *s = &tlb_shootdown[current_coreid()];
+
+    if(s -> stale)
+    {
+        s -> stale = false;
+        pte_refresh_tlb();
+    }
+}
+
+static bool tlb_batch_defer()
+{
+    if(!current -> tlb_batch_depth)
+    {
+        return false;
+    }
+
+    current -> tlb_batch_pending = true;
+    tlb_stat.batched++;
     return true;
 }
 
-bool page_transform_ptr(void **ptr)
+static void flush_tlb_all_now()
 {
-    return page_transform_addr((ulong *)ptr);
+    pte_refresh_tlb();
+    flush_tlb_others(SHOOTDOWN_ALL,0);
+    tlb_stat.all++;
 }
 
-void mem_copy_from_kernel(ulong fromaddr,ulong toaddr,ulong size)
+static void flush_tlb_page_now(ulong address)
 {
-    char *from = (char *)fromaddr;
-    char *to = (char *)toaddr;
+    pte_refresh_tlb_addr(address);
+    flush_tlb_others(SHOOTDOWN_PAGE,address);
+    tlb_stat.page++;
+}
 
-    page_transform_start();
+void flush_tlb_all()
+{
+    if(!tlb_batch_defer())
+    {
+        flush_tlb_all_now();
+    }
+}
 
-    while(size--)
+void flush_tlb_page(ulong address)
+{
+    if(!tlb_batch_defer())
     {
-        page_transform_ptr(&to);
-        *to = *from;
+        flush_tlb_page_now(address);
     }
 }
 
-void mem_copy_to_kernel(ulong fromaddr,ulong toaddr,ulong size)
+void flush_tlb_range(ulong start,ulong size)
 {
-    char *from = (char *)fromaddr;
-    char *to = (char *)toaddr;
+    ulong address;
 
-    page_transform_start();
+    if((size >> PAGING_SHIFT) > TLB_RANGE_PAGES)
+    {
+        flush_tlb_all();
+        return;
+    }
 
-    while(size--)
+    for(address = start & ~(PAGE_SIZE - 1);address < start + size;address += PAGE_SIZE)
     {
-        page_transform_ptr(&from);
-        *to = *from;
+        flush_tlb_page(address);
     }
 }
 
-void copy_page(ulong from,ulong to)
+//Address space identifiers.If the hart has them,every task gets a root table of its own and sptbr carries
+//its ASID,so a task switch keeps the TLB.asid holds a generation above the ASID bits:a task from an old
+//generation gets a new ASID when it is switched in,and once they are used up the generation moves on
+//and the TLB is flushed as a whole.ASID 0 is never handed out
+ulong asid_bits = 0;
+static ulong asid_generation = 0;
+static ulong asid_next = 1;
+
+void asid_init()
 {
-    ulong i;
+    asid_bits = pte_asid_bits();
+    asid_generation = 1UL << asid_bits;
+}
 
-    for(i = 0;i < PAGING_SIZE;i += sizeof(ulong))
+static void asid_new(struct task_struct *p)
+{
+    if(asid_next >> asid_bits)
     {
-        *(ulong *)to = *(ulong *)from;
+        asid_generation += 1UL << asid_bits;
+        asid_next = 1;
+        pte_refresh_tlb();
+        flush_tlb_others(SHOOTDOWN_ASID,0);
+        tlb_stat.rollovers++;
     }
+
+    p -> asid = asid_generation | asid_next++;
 }
 
-static uint8_t mem_map[PAGING_PAGES] = {0,};
+//Load the root table of p,which must be current now
+void switch_mm(struct task_struct *p)
+{
+    if((p -> asid & ~((1UL << asid_bits) - 1)) != asid_generation)
+    {
+        asid_new(p);
+    }
 
-//Get physical address of first(actually last) free page,and mark it used.If no free pages left,return 0
-ulong get_free_page()
+    pte_set_root_page_table_asid((volatile pte_64model *)p -> page_root,p -> asid & ((1UL << asid_bits) - 1));
+    tlb_stat.switches++;
+}
+
+//Entries of other tasks changed,none of their translations may survive
+void flush_tlb_all_tasks()
 {
-    ulong i = PAGING_PAGES;
-    ulong addr;
+    if(!asid_bits)
+    {
+        flush_tlb_all();
+        return;
+    }
 
-    while(--i)
+    asid_next = 1UL << asid_bits;
+    asid_new(current);
+    switch_mm(current);
+}
+
+//The entry for address in page table table of task p changed,which may be another task than current
+void flush_tlb_task_page(struct task_struct *p,ulong table,ulong address)
+{
+    //a table shared by fork is in other tasks as well
+    if(page_count(table) > 1)
     {
-        if(mem_map[i] == 0)
+        if(asid_bits)
         {
-            mem_map[i] = 1;
-            addr = (i << PAGING_SHIFT) + LOW_MEM;
-            memset((void *)addr,0,PAGING_SIZE);
-            return addr;
+            flush_tlb_all_tasks();
+        }
+        else
+        {
+            flush_tlb_page_now(address);
         }
+
+        return;
     }
 
-    return 0;
+    //a vfork() child and its parent share the directory,and p may be running on the other core.
+    //The batch of current only covers its own entries
+    if(p -> page_dir_table == cur_page_dir_table)
+    {
+        flush_tlb_page(address);
+    }
+    else if((p != current) && task_running(p))
+    {
+        flush_tlb_page_now(address);
+    }
+
+    if(p != current)
+    {
+        p -> asid = 0;
+    }
 }
 
-//Get physical address of first(actually last) free page,and mark it used.If no free pages left,return 0
-ulong get_free_pages(ulong pagenum)
+//Batches nest,only the outermost end flushes
+void tlb_batch_start()
+{
+    current -> tlb_batch_depth++;
+}
+
+void tlb_batch_end()
+{
+    if(!(--(current -> tlb_batch_depth)))
+    {
+        tlb_batch_flush();
+    }
+}
+
+//Do the flush deferred so far,at the end of the batch or before the task gives up the hart inside it
+void tlb_batch_flush()
+{
+    if(current -> tlb_batch_pending)
+    {
+        current -> tlb_batch_pending = false;
+        flush_tlb_all_now();
+    }
+}
+
+ulong page_count(ulong addr)
+{
+    if((addr < LOW_MEM) || (addr >= HIGH_MEMORY))
+    {
+        return 0;
+    }
+
+    return mem_map[MAP_NR(addr)];
+}
+
+//Take another reference to a page that is in use
+void get_page(ulong addr)
+{
+    if((addr < LOW_MEM) || (addr >= HIGH_MEMORY) || (!mem_map[MAP_NR(addr)]))
+    {
+        panic("get_page:page not in use");
+    }
+
+    mem_map[MAP_NR(addr)]++;
+}
+
+//Get the last run of pagenum free pages of a zone,and mark it used.If there is none,return 0.
+//The pages aren't cleared
+static ulong zone_take(struct mem_zone *zone,ulong pagenum)
 {
-    ulong i = PAGING_PAGES - 1;
-    ulong j;
-    bool exist = false;
+    ulong i,j,n = 0;
     ulong addr;
 
-    while(i > (pagenum - 1))
+    for(i = MAP_NR(zone -> end);i > MAP_NR(zone -> start);)
     {
-        exist = false;
+        n = mem_map[--i] ? 0 : n + 1;
 
-        for(j = i;j >= i - pagenum + 1;j--)
+        if(n == pagenum)
         {
-            if(mem_map[j] != 0)
+            for(j = i;j < i + pagenum;j++)
             {
-                exist = true;
-                i = j - 1;
-                break;
+                mem_map[j] = 1;
             }
+
+            return (i << PAGING_SHIFT) + LOW_MEM;
         }
+    }
+
+    return 0;
+}
+
+//Like zone_take(),the pages come zeroed
+static ulong zone_alloc(struct mem_zone *zone,ulong pagenum)
+{
+    ulong addr = zone_take(zone,pagenum);
+
+    if(addr)
+    {
+        offload_zero((void *)addr,PAGING_SIZE * pagenum);
+    }
+
+    return addr;
+}
+
+//Pages of ZONE_NORMAL an idle core had core 1 zero,single page allocations take them without clearing them
+#define ZERO_POOL_PAGES 16
+
+static ulong zero_pool[ZERO_POOL_PAGES];
+static ulong zero_pool_count = 0;
+static ulong zero_pool_pending = 0;//still being zeroed
+
+static void zero_pool_done(struct offload_job *job)
+{
+    zero_pool[zero_pool_count++] = (ulong)job -> dst;
+    zero_pool_pending--;
+}
+
+//Called by an idle task before it waits for work
+void zero_pool_refill()
+{
+    ulong page;
 
-        if(!exist)
+    offload_reap();
+
+    while((zero_pool_count + zero_pool_pending < ZERO_POOL_PAGES) && (page = zone_take(&mem_zone[ZONE_NORMAL],1)))
+    {
+        if(!offload_post(OFFLOAD_ZERO,(void *)page,NULL,PAGE_SIZE,zero_pool_done,NULL))
         {
-            for(j = i;j >= i - pagenum + 1;j--)
+            free_page(page);
+            break;
+        }
+
+        zero_pool_pending++;
+    }
+}
+
+static ulong zero_pool_get()
+{
+    offload_reap();
+
+    if(!zero_pool_count)
+    {
+        return 0;
+    }
+
+    offload_stat.zeroed_pages++;
+    return zero_pool[--zero_pool_count];
+}
+
+//Give the zeroed pages back when memory runs out,returns the number freed
+static ulong zero_pool_shrink()
+{
+    ulong n = zero_pool_count;
+
+    while(zero_pool_count)
+    {
+        free_page(zero_pool[--zero_pool_count]);
+    }
+
+    return n;
+}
+
+//Get pagenum contiguous free pages from one of the zones in the mask,return 0 if no zone has them
+ulong get_zone_pages(ulong zones,ulong pagenum)
+{
+    ulong addr;
+    int i;
+
+    for(i = 0;i < NR_ZONES;i++)
+    {
+        if((zones & ZONE_MASK(i)) && (addr = zone_alloc(&mem_zone[i],pagenum)))
+        {
+            return addr;
+        }
+    }
+
+    return 0;
+}
+
+//Get a free page from one of the zones in the mask.
+//If no free pages left,empty slabs are reaped,clean file pages dropped and anonymous pages compressed into swap first,
+//return 0 if that doesn't help either
+ulong get_zone_page(ulong zones)
+{
+    ulong addr;
+
+    repeat:
+
+    if(((zones & ZONE_MASK(ZONE_NORMAL)) && (addr = zero_pool_get())) || (addr = get_zone_pages(zones,1)))
+    {
+        return addr;
+    }
+
+    if(zero_pool_shrink() || drain_deferred_tables(~0UL) || kmem_cache_reap() || text_cache_reap() || drop_clean_page() || swap_out())
+    {
+        goto repeat;
+    }
+
+    return 0;
+}
+
+ulong get_free_page()
+{
+    return get_zone_page(ZONES_ALL);
+}
+
+//Get pagenum contiguous free pages without reclaim.If there are none,return 0
+ulong get_free_pages(ulong pagenum)
+{
+    return get_zone_pages(ZONES_ALL,pagenum);
+}
+
+//Get a 2MB aligned run of 512 free pages for a megapage,return 0 if there is none
+static ulong get_free_megapage()
+{
+    ulong base,i;
+
+    for(base = (LOW_MEM + PAGING_HIGH_LEVEL_SIZE - 1) & ~(PAGING_HIGH_LEVEL_SIZE - 1);base + PAGING_HIGH_LEVEL_SIZE <= HIGH_MEMORY;base += PAGING_HIGH_LEVEL_SIZE)
+    {
+        for(i = 0;(i < PAGE_TABLE_ITEM_NUM) && (!mem_map[MAP_NR(base) + i]);i++);
+
+        if(i == PAGE_TABLE_ITEM_NUM)
+        {
+            for(i = 0;i < PAGE_TABLE_ITEM_NUM;i++)
             {
-                mem_map[j] = 1;
+                mem_map[MAP_NR(base) + i] = 1;
             }
 
-            addr = ((i - pagenum + 1) << PAGING_SHIFT) + LOW_MEM;
-            memset((void *)addr,0,PAGING_SIZE * pagenum);
-            return addr;
+            offload_zero((void *)base,PAGING_HIGH_LEVEL_SIZE);
+            return base;
         }
     }
 
@@ -190,12 +598,53 @@ void free_pages(ulong addr,ulong pagenum)
     }
 }
 
-//This function frees a continuous block of page tables,as needed by 'exit()'.As does copy_page_tables(),this handles only 2Mb blocks
-int free_page_tables(ulong from,volatile pte_sv39 *dir,ulong size)
+//Free what one page directory entry maps,the entry is cleared
+static void free_dir_entry(volatile pte_sv39 *dir)
 {
     volatile pte_sv39 *pg_table;
     ulong nr;
 
+    if(pte_common_is_leaf((volatile pte_64model *)dir))
+    {
+        free_pages(pte_common_ppn_to_addr((volatile pte_64model *)dir),PAGE_TABLE_ITEM_NUM);
+        pte_common_init((volatile pte_64model *)dir,1);
+        return;
+    }
+
+    pg_table = (volatile pte_sv39 *)pte_common_ppn_to_addr((volatile pte_64model *)dir);
+
+    //another task still uses the table and its pages
+    if(mem_map[MAP_NR((ulong)pg_table)] > 1)
+    {
+        free_page((ulong)pg_table);
+        pte_common_init((volatile pte_64model *)dir,1);
+        return;
+    }
+
+    for(nr = 0;nr < PAGE_TABLE_ITEM_NUM;nr++)
+    {
+        if(pg_table -> v)
+        {
+            free_page(pte_common_ppn_to_addr((volatile pte_64model *)pg_table));
+        }
+        else if(PTE_IS_SWAP(pg_table))
+        {
+            swap_free(((volatile pte_64model *)pg_table) -> ppn);
+        }
+
+        pte_common_init((volatile pte_64model *)pg_table,1);
+        pg_table++;
+    }
+
+    free_page(pte_common_ppn_to_addr((volatile pte_64model *)dir));
+    pte_common_init((volatile pte_64model *)dir,1);
+}
+
+//This function frees a continuous block of page tables,as needed by 'exit()'.As does copy_page_tables(),this handles only 2Mb blocks
+int free_page_tables(ulong from,volatile pte_sv39 *dir,ulong size)
+{
+    bool active = (dir == cur_page_dir_table);//another task's entries aren't in the TLB
+
     //if(ALIGN_TEST_2MB(from))
     if(ALIGN_TEST_4KB(from))
     {
@@ -209,7 +658,59 @@ int free_page_tables(ulong from,volatile pte_sv39 *dir,ulong size)
     }
 
     size = GET_PAGE_DIR_SIZE(size);
-    dir = &page_dir_table[GET_PAGE_DIR_ID(from)];
+    dir = &dir[GET_PAGE_DIR_ID(from)];
+
+    for(;size-- > 0;dir++)
+    {
+        if(dir -> v)
+        {
+            free_dir_entry(dir);
+        }
+    }
+
+    if(active)
+    {
+        flush_tlb_all();
+    }
+}
+
+//Directory entries taken off exiting and exec'ing tasks,freed later by the idle task or under memory pressure.
+//The queue is one page,allocated on first use and given back once it is drained
+struct deferred_tables
+{
+    ulong count;
+    pte_sv39 entry[PAGE_SIZE / sizeof(pte_sv39) - 1];
+};
+
+#define DEFERRED_TABLES_MAX (sizeof(((struct deferred_tables *)0) -> entry) / sizeof(pte_sv39))
+
+static struct deferred_tables *deferred_tables = NULL;
+struct defer_stat defer_stat;
+
+//Like free_page_tables(),but only unhooks the entries.The pages stay allocated until drain_deferred_tables()
+int defer_page_tables(ulong from,volatile pte_sv39 *dir,ulong size)
+{
+    bool active = (dir == cur_page_dir_table);
+
+    if(ALIGN_TEST_4KB(from))
+    {
+        printk("addr = %p  ",from);
+        panic("defer_page_tables called with wrong alignment");
+    }
+
+    if(!from)
+    {
+        panic("Trying to free up swapper memory space");
+    }
+
+    //no reclaim here,it would drain the queue we are filling
+    if((!deferred_tables) && (deferred_tables = (struct deferred_tables *)get_zone_pages(ZONES_ALL,1)))
+    {
+        deferred_tables -> count = 0;
+    }
+
+    size = GET_PAGE_DIR_SIZE(size);
+    dir = &dir[GET_PAGE_DIR_ID(from)];
 
     for(;size-- > 0;dir++)
     {
@@ -218,24 +719,54 @@ int free_page_tables(ulong from,volatile pte_sv39 *dir,ulong size)
             continue;
         }
 
-        pg_table = (volatile pte_sv39 *)pte_common_ppn_to_addr((volatile pte_64model *)dir);
-
-        for(nr = 0;nr < PAGE_TABLE_ITEM_NUM;nr++)
+        if(deferred_tables && (deferred_tables -> count < DEFERRED_TABLES_MAX))
         {
-            if(pg_table -> v)
-            {
-                free_page(pte_common_ppn_to_addr((volatile pte_64model *)pg_table));
-            }
+            deferred_tables -> entry[deferred_tables -> count++] = *dir;
+            pte_common_init((volatile pte_64model *)dir,1);
+            defer_stat.deferred++;
+        }
+        else
+        {
+            free_dir_entry(dir);
+            defer_stat.direct++;
+        }
+    }
+
+    if(active)
+    {
+        flush_tlb_all();
+    }
+
+    return 0;
+}
+
+//Free up to max deferred directory entries,returns the number freed
+ulong drain_deferred_tables(ulong max)
+{
+    pte_sv39 entry;
+    ulong freed = 0;
 
-            pte_common_init((volatile pte_64model *)pg_table,1);
-            pg_table++;
+    while(deferred_tables && (freed < max))
+    {
+        if(!deferred_tables -> count)
+        {
+            free_page((ulong)deferred_tables);
+            deferred_tables = NULL;
+            break;
         }
 
-        free_page(pte_common_ppn_to_addr((volatile pte_64model *)dir));
-        pte_common_init((volatile pte_64model *)dir,1);
+        entry = deferred_tables -> entry[--deferred_tables -> count];
+        free_dir_entry(&entry);
+        freed++;
     }
 
-    invalidate();
+    defer_stat.drained += freed;
+    return freed;
+}
+
+ulong deferred_tables_pending()
+{
+    return deferred_tables ? deferred_tables -> count : 0;
 }
 
 //It copies a range of linear addresses by copying only the pages
@@ -258,8 +789,8 @@ int copy_page_tables(ulong from,ulong to,volatile pte_sv39 *to_dir,ulong size)
         panic("copy_page_tables called with wrong alignment");
     }
 
-    from_dir = &page_dir_table[GET_PAGE_DIR_ID(from)];
-    //to_dir = &page_dir_table[GET_PAGE_DIR_ID(to)];
+    from_dir = &cur_page_dir_table[GET_PAGE_DIR_ID(from)];
+    to_dir = &to_dir[GET_PAGE_DIR_ID(to)];
     size = GET_PAGE_DIR_SIZE(size);
 
     for(;size-- > 0;from_dir++,to_dir++)
@@ -274,8 +805,40 @@ int copy_page_tables(ulong from,ulong to,volatile pte_sv39 *to_dir,ulong size)
             continue;
         }
 
+        //a megapage is shared write-protected as a whole,it is split when either side writes
+        if(pte_common_is_leaf((volatile pte_64model *)from_dir))
+        {
+            from_dir -> w = 0;
+            *to_dir = *from_dir;
+            pagebaseaddr = pte_common_ppn_to_addr((volatile pte_64model *)from_dir);
+
+            for(nr = 0;nr < PAGE_TABLE_ITEM_NUM;nr++)
+            {
+                mem_map[MAP_NR(pagebaseaddr) + nr]++;
+            }
+
+            continue;
+        }
+
         from_page_table = (volatile pte_sv39 *)pte_common_ppn_to_addr((volatile pte_64model *)from_dir);
-        
+
+        //share the whole table,it is copied by unshare_page_table() on the first write fault in its 2MB range
+        if(pgtable_share_enable)
+        {
+            for(nr = 0;nr < PAGE_TABLE_ITEM_NUM;nr++)
+            {
+                if(from_page_table[nr].v)
+                {
+                    from_page_table[nr].w = 0;
+                }
+            }
+
+            *to_dir = *from_dir;
+            mem_map[MAP_NR((ulong)from_page_table)]++;
+            pgtable_stat.shared++;
+            continue;
+        }
+
         if(!(to_page_table = (volatile pte_sv39 *)get_free_page()))
         {
             return -1;
@@ -283,12 +846,20 @@ int copy_page_tables(ulong from,ulong to,volatile pte_sv39 *to_dir,ulong size)
 
         pte_common_addr_to_ppn((volatile pte_64model *)to_dir,(ulong)to_page_table);
         pte_common_set_accessibility((volatile pte_64model *)to_dir,pte_accessibility_pointer);
+        pte_common_enable_user((volatile pte_64model *)to_dir);
         pte_common_enable_entry((volatile pte_64model *)to_dir);
 
         nr = 512;
 
         for(;nr-- > 0;from_page_table++,to_page_table++)
         {
+            if(PTE_IS_SWAP(from_page_table))
+            {
+                swap_duplicate(((volatile pte_64model *)from_page_table) -> ppn);
+                *to_page_table = *from_page_table;
+                continue;
+            }
+
             if(!from_page_table -> v)
             {
                 continue;
@@ -306,34 +877,60 @@ int copy_page_tables(ulong from,ulong to,volatile pte_sv39 *to_dir,ulong size)
         }
     }
 
-    invalidate();
+    //the source entries lost their write permission
+    flush_tlb_all();
     return 0;
 }
 
-//This function puts a page in memory at the wanted address
-//It returns the physical address of the page gotten,0 if 
-//out of memory(either when trying to access page-table or page)
-ulong put_page(ulong page,ulong address)
+//Give the current task a private copy of a page table shared by fork,returns the table.
+//Every page and swap slot in it gains a reference,so the usual COW rules apply to the entries afterwards
+static volatile pte_sv39 *unshare_page_table(volatile pte_sv39 *dir)
 {
-    ulong tmp;
-    volatile pte_sv39 *page_table;
+    volatile pte_sv39 *old_table = (volatile pte_sv39 *)pte_common_ppn_to_addr((volatile pte_64model *)dir);
+    volatile pte_sv39 *new_table;
+    ulong page,nr;
 
-    if(page < LOW_MEM || page >= HIGH_MEMORY)
+    if(mem_map[MAP_NR((ulong)old_table)] == 1)
     {
-        printk("Trying to put page %p\n",page,address);
+        return old_table;
     }
 
-    if(mem_map[(page - LOW_MEM) >> PAGING_SHIFT] != 1)
+    if(!(new_table = (volatile pte_sv39 *)get_free_page()))
     {
-        printk("mem_map disagrees with %p at %p\n",page,address);
+        oom();
+    }
+
+    for(nr = 0;nr < PAGE_TABLE_ITEM_NUM;nr++)
+    {
+        new_table[nr] = old_table[nr];
+
+        if(PTE_IS_SWAP(&old_table[nr]))
+        {
+            swap_duplicate(((volatile pte_64model *)&old_table[nr]) -> ppn);
+        }
+        else if(old_table[nr].v && ((page = pte_common_ppn_to_addr((volatile pte_64model *)&old_table[nr])) >= LOW_MEM))
+        {
+            mem_map[MAP_NR(page)]++;
+        }
     }
 
-    page_table = &page_dir_table[GET_PAGE_DIR_ID(address)];
+    mem_map[MAP_NR((ulong)old_table)]--;
+    pte_common_addr_to_ppn((volatile pte_64model *)dir,(ulong)new_table);
+    flush_tlb_all();
+    pgtable_stat.unshared++;
+    return new_table;
+}
+
+//Returns the entry for address in the current task,allocating its page table if needed.NULL if out of memory
+static volatile pte_sv39 *alloc_page_entry(ulong address)
+{
+    ulong tmp;
+    volatile pte_sv39 *page_table = &cur_page_dir_table[GET_PAGE_DIR_ID(address)];
     //syslog_print("page_table address = %p\r\n",page_table);
 
     if(page_table -> v)
     {
-        page_table = (volatile pte_sv39 *)pte_common_ppn_to_addr((volatile pte_64model *)page_table);
+        page_table = unshare_page_table(page_table);
     }
     else
     {
@@ -350,19 +947,79 @@ ulong put_page(ulong page,ulong address)
         page_table = (volatile pte_sv39 *)tmp;
     }
 
-    //syslog_print("%d\r\n",(address >> PAGING_SHIFT) & (PAGE_TABLE_ITEM_NUM - 1));
-    page_table = &page_table[GET_PAGE_ENTRY_ID(address)];
+    //syslog_print("%d\r\n",(address >> PAGING_SHIFT) & (PAGE_TABLE_ITEM_NUM - 1));
+    return &page_table[GET_PAGE_ENTRY_ID(address)];
+}
+
+//This function puts a page in memory at the wanted address
+//It returns the physical address of the page gotten,0 if 
+//out of memory(either when trying to access page-table or page)
+ulong put_page(ulong page,ulong address)
+{
+    volatile pte_sv39 *page_table;
+
+    if(page < LOW_MEM || page >= HIGH_MEMORY)
+    {
+        printk("Trying to put page %p\n",page,address);
+    }
+
+    if(mem_map[(page - LOW_MEM) >> PAGING_SHIFT] != 1)
+    {
+        printk("mem_map disagrees with %p at %p\n",page,address);
+    }
+
+    if(!(page_table = alloc_page_entry(address)))
+    {
+        return 0;
+    }
+
     pte_common_addr_to_ppn((volatile pte_64model *)page_table,page);
     pte_common_set_accessibility((volatile pte_64model *)page_table,pte_accessibility_all);
     pte_common_enable_user((volatile pte_64model *)page_table);
     pte_common_enable_entry((volatile pte_64model *)page_table);
-    //no need for invalidate
-    invalidate();
+    flush_tlb_page(address);
     return page;
 }
 
+//Map a page of the text cache read-only at address,a write fault copies it.Returns false if out of memory for the page table
+static bool put_text_page(ulong page,ulong address)
+{
+    volatile pte_sv39 *page_table;
+
+    if(!(page_table = alloc_page_entry(address)))
+    {
+        return false;
+    }
+
+    pte_common_addr_to_ppn((volatile pte_64model *)page_table,page);
+    pte_common_set_accessibility((volatile pte_64model *)page_table,pte_accessibility_readexecute);
+    pte_common_enable_user((volatile pte_64model *)page_table);
+    pte_common_enable_entry((volatile pte_64model *)page_table);
+    flush_tlb_page(address);
+    return true;
+}
+
+//Map the zero page read-only at address,returns false if out of memory for the page table
+static bool put_zero_page(ulong address)
+{
+    volatile pte_sv39 *page_table;
+
+    if(!(page_table = alloc_page_entry(address)))
+    {
+        return false;
+    }
+
+    pte_common_addr_to_ppn((volatile pte_64model *)page_table,ZERO_PAGE);
+    pte_common_set_accessibility((volatile pte_64model *)page_table,pte_accessibility_readexecute);
+    pte_common_enable_user((volatile pte_64model *)page_table);
+    pte_common_enable_entry((volatile pte_64model *)page_table);
+    flush_tlb_page(address);
+    zero_page_stat.mapped++;
+    return true;
+}
+
 //un_wp_page -- Un-Write Protect Page
-void un_wp_page(volatile pte_sv39 *table_entry)
+void un_wp_page(volatile pte_sv39 *table_entry,ulong address)
 {
     ulong old_page;
     ulong new_page;
@@ -372,7 +1029,7 @@ void un_wp_page(volatile pte_sv39 *table_entry)
     if((old_page) >= LOW_MEM && (mem_map[MAP_NR(old_page)] == 1))
     {
         pte_common_set_writeable((volatile pte_64model *)table_entry);
-        invalidate();
+        flush_tlb_page(address);
         return;
     }
 
@@ -390,41 +1047,195 @@ void un_wp_page(volatile pte_sv39 *table_entry)
     pte_common_set_accessibility((volatile pte_64model *)table_entry,pte_accessibility_all);
     pte_common_enable_user((volatile pte_64model *)table_entry);
     pte_common_enable_entry((volatile pte_64model *)table_entry);
-    invalidate();
+    flush_tlb_page(address);
+
+    //get_free_page() has cleared it already
+    if(old_page == ZERO_PAGE)
+    {
+        zero_page_stat.copied++;
+        return;
+    }
+
     copy_page(old_page,new_page);
 }
 
+//Turn a 2MB leaf into a page table of 4KB entries with the same flags,each entry keeps its page's reference
+static void split_megapage(volatile pte_sv39 *dir,ulong address)
+{
+    volatile pte_sv39 *pte;
+    ulong table,page,i;
+
+    if(!(table = get_free_page()))
+    {
+        oom();
+    }
+
+    page = pte_common_ppn_to_addr((volatile pte_64model *)dir);
+    pte = (volatile pte_sv39 *)table;
+
+    for(i = 0;i < PAGE_TABLE_ITEM_NUM;i++,pte++,page += PAGE_SIZE)
+    {
+        *pte = *dir;
+        pte_common_addr_to_ppn((volatile pte_64model *)pte,page);
+    }
+
+    pte_common_init((volatile pte_64model *)dir,1);
+    pte_common_addr_to_ppn((volatile pte_64model *)dir,table);
+    pte_common_set_accessibility((volatile pte_64model *)dir,pte_accessibility_pointer);
+    pte_common_enable_user((volatile pte_64model *)dir);
+    pte_common_enable_entry((volatile pte_64model *)dir);
+    flush_tlb_page(address);//one TLB entry covers the whole megapage
+    megapage_stat.split++;
+}
+
+//Returns the 4KB entry for address in the current task,ready to be written:
+//a megapage is split and a page table shared by fork is copied on the way.NULL if there is no page table
+volatile pte_sv39 *get_page_entry(ulong address)
+{
+    volatile pte_sv39 *dir = &cur_page_dir_table[GET_PAGE_DIR_ID(address)];
+
+    if(!dir -> v)
+    {
+        return NULL;
+    }
+
+    if(pte_common_is_leaf((volatile pte_64model *)dir))
+    {
+        split_megapage(dir,address);
+    }
+
+    return unshare_page_table(dir) + GET_PAGE_ENTRY_ID(address);
+}
+
 //This routine handles present pages,when users try to write to a shared page.
 //It is done by copying the page to a new address and decrementing the shared-page counter for the old page.
-//If it's in code space we exit with a segment error
 void do_wp_page(ulong address)
 {
-    volatile pte_sv39 *dir = &page_dir_table[GET_PAGE_DIR_ID(address)];
-    volatile pte_sv39 *entry = (volatile pte_sv39 *)pte_common_ppn_to_addr((volatile pte_64model *)dir);
-    un_wp_page(&entry[GET_PAGE_ENTRY_ID(address)]);
+    struct vm_area_struct *vma = find_vma(address);
+
+    if(vma && (!(vma -> vm_flags & VM_WRITE)))
+    {
+        printk("write to read-only mapping at %p\r\n",address);
+        do_exit(SIGSEGV);
+    }
+
+    un_wp_page(get_page_entry(address),address);
 }
 
 void write_verify(ulong address)
 {
-    volatile pte_sv39 *dir = &page_dir_table[GET_PAGE_DIR_ID(address)];
+    volatile pte_sv39 *dir = &cur_page_dir_table[GET_PAGE_DIR_ID(address)];
 
     if(dir -> v == 0)
     {
         return;
     }
 
-    volatile pte_sv39 *page = ((volatile pte_sv39 *)pte_common_ppn_to_addr((volatile pte_64model *)dir)) + GET_PAGE_ENTRY_ID(address);
+    //a writable megapage needs no splitting
+    if(pte_common_is_leaf((volatile pte_64model *)dir) && dir -> w)
+    {
+        return;
+    }
+
+    volatile pte_sv39 *page = (volatile pte_sv39 *)pte_common_ppn_to_addr((volatile pte_64model *)dir) + GET_PAGE_ENTRY_ID(address);
 
-    if((page -> v == 1) && (page -> w == 0))
+    //a leaf is always write-protected here
+    if(pte_common_is_leaf((volatile pte_64model *)dir) || ((page -> v == 1) && (page -> w == 0)))
     {
-        un_wp_page(page);
+        un_wp_page(get_page_entry(address),address);
     }
 }
 
-void get_empty_page(ulong address)
+//The entry mapping address in the current task without splitting or unsharing anything,
+//a megapage directory entry or NULL if there is no page table
+static volatile pte_sv39 *lookup_page_entry(ulong address)
+{
+    volatile pte_sv39 *dir = &cur_page_dir_table[GET_PAGE_DIR_ID(address)];
+
+    if(!dir -> v)
+    {
+        return NULL;
+    }
+
+    if(pte_common_is_leaf((volatile pte_64model *)dir))
+    {
+        return dir;
+    }
+
+    return ((volatile pte_sv39 *)pte_common_ppn_to_addr((volatile pte_64model *)dir)) + GET_PAGE_ENTRY_ID(address);
+}
+
+//Has address of the current task a page already,in memory or in swap
+bool page_mapped(ulong address)
+{
+    volatile pte_sv39 *pte = lookup_page_entry(address);
+    return pte && (pte -> v || PTE_IS_SWAP(pte));
+}
+
+//Fault in the pages of the current task in [start,end) now,with write as private writable pages
+void make_pages_present(ulong start,ulong end,bool write)
+{
+    volatile pte_sv39 *pte;
+    ulong address;
+
+    for(address = start & ~(PAGE_SIZE - 1);address < end;address += PAGE_SIZE)
+    {
+        pte = lookup_page_entry(address);
+
+        if((!pte) || (!pte -> v))
+        {
+            do_no_page(address,write);
+        }
+
+        if(write)
+        {
+            write_verify(address);
+        }
+    }
+}
+
+//Unmap the pages of the current task in [from,from + size),used by munmap()
+void zap_page_range(ulong from,ulong size)
+{
+    volatile pte_sv39 *pte;
+    ulong address;
+
+    for(address = from;address < from + size;)
+    {
+        if(!cur_page_dir_table[GET_PAGE_DIR_ID(address)].v)
+        {
+            address = (address + PAGING_HIGH_LEVEL_SIZE) & ~(PAGING_HIGH_LEVEL_SIZE - 1);
+            continue;
+        }
+
+        pte = get_page_entry(address);
+
+        if(pte -> v)
+        {
+            free_page(pte_common_ppn_to_addr((volatile pte_64model *)pte));
+        }
+        else if(PTE_IS_SWAP(pte))
+        {
+            swap_free(((volatile pte_64model *)pte) -> ppn);
+        }
+
+        pte_common_init((volatile pte_64model *)pte,1);
+        address += PAGE_SIZE;
+    }
+
+    flush_tlb_range(from,size);
+}
+
+//A read fault gets the zero page,a write fault a page of its own
+void get_empty_page(ulong address,bool write)
 {
     ulong tmp;
 
+    if((!write) && put_zero_page(address))
+    {
+        return;
+    }
+
     if(!(tmp = get_free_page()) || (!put_page(tmp,address)))
     {
         syslog_print("error\r\n");
@@ -449,32 +1260,18 @@ static int try_to_share(ulong address,struct task_struct *p)
     from_page = &(p -> page_dir_table[GET_PAGE_DIR_ID(address)]);
     to_page = &(current -> page_dir_table[GET_PAGE_DIR_ID(address)]);
 
-    if(!(from_page -> v))
-    {
-        return 0;
-    }
-
-    from_page = ((pte_sv39 *)pte_common_ppn_to_addr(from_page)) + GET_PAGE_ENTRY_ID(address);
-
-    //is the page clean and present?
-    if((!from_page -> v) || from_page -> d)
-    {
-        return 0;
-    }
-
-    phys_addr = pte_common_ppn_to_addr(from_page);
-
-    if((phys_addr >= HIGH_MEMORY) || (phys_addr < LOW_MEM))
+    if((!(from_page -> v)) || pte_common_is_leaf((volatile pte_64model *)from_page) || pte_common_is_leaf((volatile pte_64model *)to_page))
     {
         return 0;
     }
 
+    //get our own table first,allocating it may reclaim the page we are about to share
     if(!(to_page -> v))
     {
         if(to = get_free_page())
         {
             pte_common_addr_to_ppn(to_page,to);
-            pte_common_set_accessibility(to_page,pte_accessibility_all);
+            pte_common_set_accessibility(to_page,pte_accessibility_pointer);
             pte_common_enable_entry(to_page);
             pte_common_enable_user(to_page);
         }
@@ -484,7 +1281,27 @@ static int try_to_share(ulong address,struct task_struct *p)
         }
     }
 
-    to_page = ((pte_sv39 *)pte_common_ppn_to_addr(to_page)) + GET_PAGE_ENTRY_ID(address);
+    to_page = ((pte_sv39 *)unshare_page_table(to_page)) + GET_PAGE_ENTRY_ID(address);
+
+    if((!from_page -> v) || pte_common_is_leaf((volatile pte_64model *)from_page))
+    {
+        return 0;
+    }
+
+    from_page = ((pte_sv39 *)pte_common_ppn_to_addr(from_page)) + GET_PAGE_ENTRY_ID(address);
+
+    //is the page clean and present?
+    if((!from_page -> v) || from_page -> d)
+    {
+        return 0;
+    }
+
+    phys_addr = pte_common_ppn_to_addr(from_page);
+
+    if((phys_addr >= HIGH_MEMORY) || (phys_addr < LOW_MEM))
+    {
+        return 0;
+    }
 
     if(to_page -> v)
     {
@@ -494,7 +1311,8 @@ static int try_to_share(ulong address,struct task_struct *p)
     //share them:write-protect
     from_page -> w = 0;
     to_page -> w = 0;
-    invalidate();
+    flush_tlb_page(address);
+    flush_tlb_task_page(p,((ulong)from_page) & ~(PAGE_SIZE - 1),address);
     phys_addr -= LOW_MEM;
     phys_addr >>= PAGING_SHIFT;
     mem_map[phys_addr]++;
@@ -545,14 +1363,44 @@ static int share_page(ulong address)
     return 0;
 }
 
+//Map a whole 2MB megapage if the aligned block around address lies inside the heap and nothing in it is mapped yet
+static bool do_anonymous_megapage(ulong address)
+{
+    volatile pte_sv39 *dir = &cur_page_dir_table[GET_PAGE_DIR_ID(address)];
+    ulong base = address & ~(PAGING_HIGH_LEVEL_SIZE - 1);
+    ulong page;
+
+    if((!megapage_enable) || (!current -> executable) || dir -> v || (base < current -> end_data) || (base + PAGING_HIGH_LEVEL_SIZE > current -> brk))
+    {
+        return false;
+    }
+
+    if(!(page = get_free_megapage()))
+    {
+        megapage_stat.failed++;
+        return false;
+    }
+
+    pte_common_addr_to_ppn((volatile pte_64model *)dir,page);
+    pte_common_set_accessibility((volatile pte_64model *)dir,pte_accessibility_all);
+    pte_common_enable_user((volatile pte_64model *)dir);
+    pte_common_enable_entry((volatile pte_64model *)dir);
+    flush_tlb_page(base);
+    megapage_stat.mapped++;
+    return true;
+}
+
 //int first = 1;
 
-void do_no_page(ulong address)
+void do_no_page(ulong address,bool write)
 {
+    struct vm_area_struct *vma;
     int nr[4];
     ulong tmp;
     ulong page;
     int block,i;
+    bool text;
+    uint32_t gen;
     //syslog_print("address = %p,cause = %d,epc = %p\r\n",address,csr_read(csr_mcause).value,trap_info.epc);
     address &= ~(PAGE_SIZE - 1);
     /*sysctl_disable_irq();
@@ -627,26 +1475,47 @@ void do_no_page(ulong address)
     }*/
 
     //syslog_print("check,%p,%d,%p\r\n",address,current -> executable,current -> end_data);
-    tmp = address;
-
-    if((!current -> executable) || (tmp >= current -> end_data))
+    if(swap_in(address))
     {
-        get_empty_page(address);
         return;
     }
 
-    //syslog_print("share_page\r\n");
+    tmp = address;
 
-    if(share_page(tmp))
+    //tasks set up by exec dispatch on the area type,text and data still come from the executable below
+    if(current -> mmap)
     {
-        return;
-    }
+        if((!(vma = find_vma(address))) && (!(vma = expand_stack(address))))
+        {
+            printk("segmentation fault at %p,epc = %p\r\n",address,trap_info.epc);
+            do_exit(SIGSEGV);
+        }
 
-    //syslog_print("get_free_page\r\n");
+        if(vma -> vm_type == VMA_FILE)
+        {
+            do_file_page(vma,address);
+            return;
+        }
 
-    if(!(page = get_free_page()))
+        if((vma -> vm_type == VMA_HEAP) || (vma -> vm_type == VMA_STACK))
+        {
+            //a read is cheaper on the zero page than on a fresh megapage
+            if((vma -> vm_type != VMA_HEAP) || (!write) || (!do_anonymous_megapage(address)))
+            {
+                get_empty_page(address,write);
+            }
+
+            return;
+        }
+    }
+    else if((!current -> executable) || (tmp >= current -> end_data))
     {
-        oom();
+        if((!write) || (!do_anonymous_megapage(address)))
+        {
+            get_empty_page(address,write);
+        }
+
+        return;
     }
 
     tmp = address - current -> start_code;
@@ -659,7 +1528,51 @@ void do_no_page(ulong address)
         nr[i] = bmap(current -> executable,block);
     }
 
+    //whole pages of text may be resident from an earlier run,or on the ramdisk
+    text = (address >= current -> start_code) && (address + PAGE_SIZE <= current -> end_code);
+
+    #ifdef CONFIG_RAMDISK_XIP
+        //the ramdisk page is mapped itself,it is below LOW_MEM so nothing counts references to it
+        if(text && (page = rd_xip_page(current -> executable -> i_dev,nr)))
+        {
+            if(put_text_page(page,address))
+            {
+                xip_pages++;
+                return;
+            }
+
+            oom();
+        }
+    #endif
+
+    if(text && (page = text_cache_find(current -> executable,(address - current -> start_code) >> PAGING_SHIFT)))
+    {
+        if(put_text_page(page,address))
+        {
+            return;
+        }
+
+        free_page(page);
+        oom();
+    }
+
+    //syslog_print("share_page\r\n");
+
+    if(share_page(address))
+    {
+        return;
+    }
+
+    //syslog_print("get_free_page\r\n");
+
+    if(!(page = get_free_page()))
+    {
+        oom();
+    }
+
     //syslog_print("bread_page\r\n");
+    //bread_page() sleeps,text_cache_add() checks that nothing invalidated the file meanwhile
+    gen = current -> executable -> i_text_gen;
     bread_page(page,current -> executable -> i_dev,nr);
     
     i = tmp + current -> start_code + 4096 - current -> end_data;
@@ -672,6 +1585,18 @@ void do_no_page(ulong address)
         *(char *)tmp = 0;
     }
 
+    if(text && text_cache_add(current -> executable,(address - current -> start_code) >> PAGING_SHIFT,page,gen))
+    {
+        if(put_text_page(page,address))
+        {
+            return;
+        }
+
+        //the cache keeps its reference
+        free_page(page);
+        oom();
+    }
+
     //syslog_print("put_page\r\n");
     //syslog_print("dir %d,entry %d\r\n",GET_PAGE_DIR_ID(address),GET_PAGE_ENTRY_ID(address));
     if(put_page(page,address))
@@ -699,9 +1624,12 @@ void do_no_page(ulong address)
 
 extern void machine_exception_store_or_amo_access_fault(ulong addr);
 
+//The kernel writes through physical addresses,so the MMU neither copies on write nor sets the dirty bit for it.
+//Both are done here,reclaim relies on d to tell pages which differ from the file.
 bool user_addr_to_kernel_write(ulong *addr)
 {
     int first = 1;
+    volatile pte_sv39 *pte;
 
     repeat:
 
@@ -710,7 +1638,7 @@ bool user_addr_to_kernel_write(ulong *addr)
         return true;
     }
 
-    if(page_dir_table == NULL)
+    if(cur_page_dir_table == NULL)
     {
         panic("page_dir_table is null\r\n");
         return false;
@@ -722,7 +1650,7 @@ bool user_addr_to_kernel_write(ulong *addr)
         return false;
     }
 
-    if(!page_dir_table[GET_PAGE_DIR_ID(*addr)].v)
+    if(!cur_page_dir_table[GET_PAGE_DIR_ID(*addr)].v)
     {
         if(first == 1)
         {
@@ -736,7 +1664,24 @@ bool user_addr_to_kernel_write(ulong *addr)
         return false;
     }
     
-    volatile pte_sv39 *pt = (volatile pte_sv39 *)pte_common_ppn_to_addr((volatile pte_64model *)&page_dir_table[GET_PAGE_DIR_ID(*addr)]);
+    if(pte_common_is_leaf((volatile pte_64model *)&cur_page_dir_table[GET_PAGE_DIR_ID(*addr)]))
+    {
+        pte = &cur_page_dir_table[GET_PAGE_DIR_ID(*addr)];
+
+        //fork shares megapages write-protected,the write splits it and copies the 4KB page like a user write would
+        if(!pte -> w)
+        {
+            do_wp_page(*addr);
+            goto repeat;
+        }
+
+        pte -> a = 1;
+        pte -> d = 1;
+        *addr = pte_common_ppn_to_addr((volatile pte_64model *)pte) + ((*addr) & (PAGING_HIGH_LEVEL_SIZE - 1));
+        return true;
+    }
+
+    volatile pte_sv39 *pt = (volatile pte_sv39 *)pte_common_ppn_to_addr((volatile pte_64model *)&cur_page_dir_table[GET_PAGE_DIR_ID(*addr)]);
 
     if(!pt[GET_PAGE_ENTRY_ID(*addr)].v)
     {
@@ -752,7 +1697,15 @@ bool user_addr_to_kernel_write(ulong *addr)
         return false;
     }
 
-    *addr = pte_common_ppn_to_addr(&pt[GET_PAGE_ENTRY_ID(*addr)]) + ((*addr) & 0xFFF);
+    if(!pt[GET_PAGE_ENTRY_ID(*addr)].w)
+    {
+        do_wp_page(*addr);
+    }
+
+    pte = get_page_entry(*addr);
+    pte -> a = 1;
+    pte -> d = 1;
+    *addr = pte_common_ppn_to_addr(pte) + ((*addr) & 0xFFF);
     return true;
 }
 
@@ -767,7 +1720,7 @@ bool user_addr_to_kernel(ulong *addr)
         return true;
     }
 
-    if(page_dir_table == NULL)
+    if(cur_page_dir_table == NULL)
     {
         panic("page_dir_table is null\r\n");
         return false;
@@ -779,12 +1732,12 @@ bool user_addr_to_kernel(ulong *addr)
         return false;
     }
 
-    if(!page_dir_table[GET_PAGE_DIR_ID(*addr)].v)
+    if(!cur_page_dir_table[GET_PAGE_DIR_ID(*addr)].v)
     {
         if(first == 1)
         {
             first = 0;
-            do_no_page(*addr);
+            do_no_page(*addr,false);
             goto repeat;
         }
 
@@ -793,14 +1746,20 @@ bool user_addr_to_kernel(ulong *addr)
         return false;
     }
     
-    volatile pte_sv39 *pt = (volatile pte_sv39 *)pte_common_ppn_to_addr((volatile pte_64model *)&page_dir_table[GET_PAGE_DIR_ID(*addr)]);
+    if(pte_common_is_leaf((volatile pte_64model *)&cur_page_dir_table[GET_PAGE_DIR_ID(*addr)]))
+    {
+        *addr = pte_common_ppn_to_addr((volatile pte_64model *)&cur_page_dir_table[GET_PAGE_DIR_ID(*addr)]) + ((*addr) & (PAGING_HIGH_LEVEL_SIZE - 1));
+        return true;
+    }
+
+    volatile pte_sv39 *pt = (volatile pte_sv39 *)pte_common_ppn_to_addr((volatile pte_64model *)&cur_page_dir_table[GET_PAGE_DIR_ID(*addr)]);
 
     if(!pt[GET_PAGE_ENTRY_ID(*addr)].v)
     {
         if(first == 1)
         {
             first = 0;
-            do_no_page(*addr);
+            do_no_page(*addr,false);
             goto repeat;
         }
 
@@ -822,20 +1781,37 @@ void mem_init(ulong start_mem,ulong end_mem)
 {
     int i;
 
-    HIGH_MEMORY = end_mem;
-
     for(i = 0;i < PAGING_PAGES;i++)
     {
         mem_map[i] = USED;
     }
 
-    i = MAP_NR(start_mem);
-    end_mem -= start_mem;
-    end_mem >>= PAGING_SHIFT;
+    mem_add_zone(ZONE_NORMAL,start_mem,end_mem);
+    kmem_cache_init();
+    vma_init();
+}
+
+//Give [start_mem,end_mem) to the page allocator as a zone,it must be inside the range mem_map covers
+void mem_add_zone(int zone,ulong start_mem,ulong end_mem)
+{
+    ulong i;
+
+    if((zone >= NR_ZONES) || (start_mem < LOW_MEM) || (end_mem > LOW_MEM + PAGING_MEMORY) || (start_mem >= end_mem))
+    {
+        panic("mem_add_zone:bad zone");
+    }
+
+    mem_zone[zone].start = start_mem;
+    mem_zone[zone].end = end_mem;
+
+    for(i = MAP_NR(start_mem);i < MAP_NR(end_mem);i++)
+    {
+        mem_map[i] = 0;
+    }
 
-    while(end_mem-- > 0)
+    if(end_mem > HIGH_MEMORY)
     {
-        mem_map[i++] = 0;
+        HIGH_MEMORY = end_mem;
     }
 }
 
@@ -844,6 +1820,7 @@ void calc_mem()
 {
     int i,j,k,free = 0;
     volatile pte_sv39 *pg_tbl;
+    ulong zone_free;
 
     for(i = 0;i < PAGING_PAGES;i++)
     {
@@ -855,11 +1832,37 @@ void calc_mem()
 
     printk("%d pages free (of %d)\r\n",free,PAGING_PAGES);
 
+    for(i = 0;i < NR_ZONES;i++)
+    {
+        if(mem_zone[i].end > mem_zone[i].start)
+        {
+            for(j = MAP_NR(mem_zone[i].start),zone_free = 0;j < MAP_NR(mem_zone[i].end);j++)
+            {
+                zone_free += !mem_map[j];
+            }
+
+            printk("zone %s:%p-%p,%lu of %lu pages free\r\n",mem_zone[i].name,mem_zone[i].start,mem_zone[i].end,zone_free,(mem_zone[i].end - mem_zone[i].start) >> PAGING_SHIFT);
+        }
+    }
+
+    printk("megapages:%lu mapped,%lu split,%lu without free 2MB block,%s\r\n",megapage_stat.mapped,megapage_stat.split,megapage_stat.failed,megapage_enable ? "enabled" : "disabled");
+    printk("zero page:%lu read faults mapped it,%lu copied on write\r\n",zero_page_stat.mapped,zero_page_stat.copied);
+    printk("page tables:%lu shared by fork,%lu copied on write,sharing %s\r\n",pgtable_stat.shared,pgtable_stat.unshared,pgtable_share_enable ? "enabled" : "disabled");
+    printk("tlb:%lu page flushes,%lu full flushes,%lu folded into batches,%lu switches kept the tlb\r\n",tlb_stat.page,tlb_stat.all,tlb_stat.batched,tlb_stat.switches);
+    printk("asid:%lu bits,%lu generations used up\r\n",asid_bits,tlb_stat.rollovers);
+    show_text_cache();
+    printk("xip:%lu text faults mapped the ramdisk\r\n",xip_pages);
+    printk("deferred teardown:%lu entries queued,%lu drained,%lu freed directly,%lu pending\r\n",defer_stat.deferred,defer_stat.drained,defer_stat.direct,deferred_tables_pending());
+
     for(i = 0;i < PAGE_DIR_TABLE_NUM;i++)
     {
-        if(page_dir_table[i].v == 1)
+        if(pte_common_is_leaf((volatile pte_64model *)&cur_page_dir_table[i]))
+        {
+            printk("Pg-dir[%d] is a 2MB megapage\n",i);
+        }
+        else if(cur_page_dir_table[i].v == 1)
         {
-            pg_tbl = (volatile pte_sv39 *)pte_common_ppn_to_addr((volatile pte_64model *)&page_dir_table[i]);
+            pg_tbl = (volatile pte_sv39 *)pte_common_ppn_to_addr((volatile pte_64model *)&cur_page_dir_table[i]);
 
             for(j = k = 0;j < PAGE_TABLE_ITEM_NUM;j++)
             {
@@ -0,0 +1,562 @@
+#include "common.h"
+#include "errno.h"
+#include "fcntl.h"
+#include "sys/stat.h"
+#include "sys/mman.h"
+#include "linux/sched.h"
+#include "linux/kernel.h"
+#include "linux/mm.h"
+#include "linux/fs.h"
+
+//Virtual memory areas.exec gives a task text,data,heap and stack areas,mmap() adds file areas between MMAP_BASE and MMAP_END.
+//fork and exit only walk the page tables under the areas,and the fault handler dispatches on the area type.
+//A task with an empty list(init before its first exec) keeps the old behaviour based on end_data.
+//Writes to a private file mapping stay in the task,there is no write-back
+
+#define VMA_ALIGN(x) (((x) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+#define VMA_DIR_START(x) ((x) & ~(PAGING_HIGH_LEVEL_SIZE - 1))
+#define VMA_DIR_END(x) (((x) + PAGING_HIGH_LEVEL_SIZE - 1) & ~(PAGING_HIGH_LEVEL_SIZE - 1))
+#define MLOCK_STACK_RESERVE (32UL * 1024UL)//stack below the current one which mlockall() faults in as well
+#define FAULT_AROUND_PAGES 4//pages a fault in a MADV_SEQUENTIAL area reads in one go
+#define READAHEAD_BLOCKS 4//blocks behind a file fault which are started without waiting
+#define READAHEAD_SEQ_BLOCKS 16
+
+static struct kmem_cache *vma_cachep;
+
+void vma_init()
+{
+    if(!(vma_cachep = kmem_cache_create("vm_area",sizeof(struct vm_area_struct),NULL)))
+    {
+        panic("vma_init:can't create vm_area cache");
+    }
+}
+
+static struct vm_area_struct *new_vma(ulong start,ulong end,ulong flags,int type,struct m_inode *inode,ulong offset)
+{
+    struct vm_area_struct *vma;
+
+    if(!(vma = (struct vm_area_struct *)kmem_cache_alloc(vma_cachep)))
+    {
+        return NULL;
+    }
+
+    vma -> vm_start = start;
+    vma -> vm_end = end;
+    vma -> vm_flags = flags;
+    vma -> vm_type = type;
+    vma -> vm_inode = inode;
+    vma -> vm_offset = offset;
+    vma -> vm_next = NULL;
+
+    if(inode)
+    {
+        inode -> i_count++;
+    }
+
+    return vma;
+}
+
+static void free_vma(struct vm_area_struct *vma)
+{
+    if(vma -> vm_inode)
+    {
+        iput(vma -> vm_inode);
+    }
+
+    kmem_cache_free(vma_cachep,vma);
+}
+
+static void insert_vma(struct vm_area_struct *vma)
+{
+    struct vm_area_struct **p;
+
+    for(p = &current -> mmap;*p && ((*p) -> vm_start <= vma -> vm_start);p = &(*p) -> vm_next);
+
+    vma -> vm_next = *p;
+    *p = vma;
+}
+
+static void free_vma_list(struct vm_area_struct *vma)
+{
+    struct vm_area_struct *next;
+
+    for(;vma;vma = next)
+    {
+        next = vma -> vm_next;
+        free_vma(vma);
+    }
+}
+
+struct vm_area_struct *find_vma(ulong address)
+{
+    struct vm_area_struct *vma;
+
+    for(vma = current -> mmap;vma && (vma -> vm_start <= address);vma = vma -> vm_next)
+    {
+        if(address < vma -> vm_end)
+        {
+            return vma;
+        }
+    }
+
+    return NULL;
+}
+
+//Can the page at address of task p be read back from a file,text and data from the executable or a file mapping
+bool vma_file_backed(struct task_struct *p,ulong address)
+{
+    struct vm_area_struct *vma;
+
+    if(!p -> mmap)
+    {
+        return p -> executable && (address >= p -> start_code) && (address < p -> end_data);
+    }
+
+    for(vma = p -> mmap;vma && (vma -> vm_start <= address);vma = vma -> vm_next)
+    {
+        if(address < vma -> vm_end)
+        {
+            return (vma -> vm_type == VMA_FILE) || (((vma -> vm_type == VMA_TEXT) || (vma -> vm_type == VMA_DATA)) && p -> executable);
+        }
+    }
+
+    return false;
+}
+
+//A fault between the heap and the stack grows the stack,returns NULL if address isn't there
+struct vm_area_struct *expand_stack(ulong address)
+{
+    struct vm_area_struct *vma,*prev = NULL;
+
+    for(vma = current -> mmap;vma && (vma -> vm_end <= address);prev = vma,vma = vma -> vm_next);
+
+    if((!vma) || (!(vma -> vm_flags & VM_GROWSDOWN)) || (address >= vma -> vm_start) || (prev && (address < prev -> vm_end)))
+    {
+        return NULL;
+    }
+
+    vma -> vm_start = address & ~(PAGE_SIZE - 1);
+    return vma;
+}
+
+//Text and data come from the executable through the old do_no_page() path,the areas describe them for fork and exit
+void setup_exec_vmas(struct m_inode *inode)
+{
+    struct vm_area_struct *vma[4];
+    ulong text_end = VMA_ALIGN(current -> end_code);
+    ulong data_end = VMA_ALIGN(current -> end_data);
+    ulong heap_end = VMA_ALIGN(current -> brk);
+    int i;
+
+    if(data_end < text_end)
+    {
+        data_end = text_end;
+    }
+
+    if(heap_end < data_end)
+    {
+        heap_end = data_end;
+    }
+
+    vma[0] = new_vma(current -> start_code,text_end,VM_READ | VM_WRITE | VM_EXEC,VMA_TEXT,inode,BLOCK_SIZE);
+    vma[1] = new_vma(text_end,data_end,VM_READ | VM_WRITE | VM_EXEC,VMA_DATA,inode,BLOCK_SIZE + text_end - current -> start_code);
+    vma[2] = new_vma(data_end,heap_end,VM_READ | VM_WRITE | VM_EXEC,VMA_HEAP,NULL,0);
+    vma[3] = new_vma(current -> start_stack,current -> data_base + current -> data_limit,VM_READ | VM_WRITE | VM_EXEC | VM_GROWSDOWN,VMA_STACK,NULL,0);
+
+    //all or nothing,without areas the task falls back to the old behaviour
+    for(i = 0;i < 4;i++)
+    {
+        if(vma[0] && vma[1] && vma[2] && vma[3])
+        {
+            insert_vma(vma[i]);
+        }
+        else if(vma[i])
+        {
+            free_vma(vma[i]);
+        }
+    }
+}
+
+//Copy the areas of the current task to the child p and share the page tables under them
+int dup_mmap(struct task_struct *p)
+{
+    struct vm_area_struct *vma,*copy,**tail = &p -> mmap;
+    ulong from,to,copied = 0;
+
+    p -> mmap = NULL;
+
+    for(vma = current -> mmap;vma;vma = vma -> vm_next)
+    {
+        if(!(copy = new_vma(vma -> vm_start,vma -> vm_end,vma -> vm_flags,vma -> vm_type,vma -> vm_inode,vma -> vm_offset)))
+        {
+            goto fail;
+        }
+
+        *tail = copy;
+        tail = &copy -> vm_next;
+
+        //neighbouring areas may share a 2MB directory entry
+        from = VMA_DIR_START(vma -> vm_start);
+        to = VMA_DIR_END(vma -> vm_end);
+        from = (from < copied) ? copied : from;
+
+        if(from < to)
+        {
+            if(copy_page_tables(from,from,p -> page_dir_table,to - from))
+            {
+                goto fail;
+            }
+
+            copied = to;
+        }
+    }
+
+    return 0;
+
+    fail:
+        for(vma = p -> mmap;vma;vma = vma -> vm_next)
+        {
+            free_page_tables(VMA_DIR_START(vma -> vm_start),p -> page_dir_table,VMA_DIR_END(vma -> vm_end) - VMA_DIR_START(vma -> vm_start));
+        }
+
+        free_vma_list(p -> mmap);
+        p -> mmap = NULL;
+        return -ENOMEM;
+}
+
+//Free the page tables under the areas of the current task and the areas themselves,used by exit and exec.
+//The tables are only unhooked here,the idle task frees them later.Returns false for a task without areas,the caller has to sweep the whole range then
+bool exit_mmap()
+{
+    struct vm_area_struct *vma;
+
+    if(!current -> mmap)
+    {
+        return false;
+    }
+
+    for(vma = current -> mmap;vma;vma = vma -> vm_next)
+    {
+        if(vma -> vm_start < vma -> vm_end)
+        {
+            defer_page_tables(VMA_DIR_START(vma -> vm_start),current -> page_dir_table,VMA_DIR_END(vma -> vm_end) - VMA_DIR_START(vma -> vm_start));
+        }
+    }
+
+    free_vma_list(current -> mmap);
+    current -> mmap = NULL;
+    return true;
+}
+
+//Move the end of the heap area,pages above a lowered brk are freed.Returns false if the heap would run into the next area
+bool vma_set_brk(ulong brk)
+{
+    struct vm_area_struct *vma;
+    ulong end;
+
+    for(vma = current -> mmap;vma && (vma -> vm_type != VMA_HEAP);vma = vma -> vm_next);
+
+    if(!vma)
+    {
+        return true;
+    }
+
+    end = VMA_ALIGN(brk);
+    end = (end < vma -> vm_start) ? vma -> vm_start : end;
+
+    if(vma -> vm_next && (end > vma -> vm_next -> vm_start))
+    {
+        return false;
+    }
+
+    if(end < vma -> vm_end)
+    {
+        zap_page_range(end,vma -> vm_end - end);
+    }
+    else if(current -> mlock & MCL_FUTURE)
+    {
+        make_pages_present(vma -> vm_end,end,true);
+    }
+
+    vma -> vm_end = end;
+    return true;
+}
+
+//First fit from MMAP_BASE in the sorted list
+static ulong get_unmapped_area(ulong len)
+{
+    struct vm_area_struct *vma;
+    ulong start = MMAP_BASE;
+
+    for(vma = current -> mmap;vma;vma = vma -> vm_next)
+    {
+        if(vma -> vm_end <= start)
+        {
+            continue;
+        }
+
+        if(vma -> vm_start >= start + len)
+        {
+            break;
+        }
+
+        start = vma -> vm_end;
+    }
+
+    return (start + len <= MMAP_END) ? start : 0;
+}
+
+//Cut [start,end) out of the file areas,splitting an area needs a new one
+static int unmap_areas(ulong start,ulong end)
+{
+    struct vm_area_struct **p,*vma,*tail;
+
+    for(p = &current -> mmap;(vma = *p);)
+    {
+        if((vma -> vm_type != VMA_FILE) || (start >= vma -> vm_end) || (end <= vma -> vm_start))
+        {
+            p = &vma -> vm_next;
+            continue;
+        }
+
+        if((start > vma -> vm_start) && (end < vma -> vm_end))
+        {
+            if(!(tail = new_vma(end,vma -> vm_end,vma -> vm_flags,VMA_FILE,vma -> vm_inode,vma -> vm_offset + end - vma -> vm_start)))
+            {
+                return -ENOMEM;
+            }
+
+            tail -> vm_next = vma -> vm_next;
+            vma -> vm_next = tail;
+            vma -> vm_end = start;
+        }
+        else if(start > vma -> vm_start)
+        {
+            vma -> vm_end = start;
+        }
+        else if(end < vma -> vm_end)
+        {
+            vma -> vm_offset += end - vma -> vm_start;
+            vma -> vm_start = end;
+        }
+        else
+        {
+            *p = vma -> vm_next;
+            free_vma(vma);
+            continue;
+        }
+
+        p = &vma -> vm_next;
+    }
+
+    zap_page_range(start,end - start);
+    return 0;
+}
+
+int64_t sys_mmap(ulong addr,ulong len,int prot,int flags,int fd,ulong offset)
+{
+    struct vm_area_struct *vma;
+    struct file *f;
+    struct m_inode *inode;
+
+    len = VMA_ALIGN(len);
+
+    if((!len) || (offset & (PAGE_SIZE - 1)) || (!(flags & (MAP_SHARED | MAP_PRIVATE))))
+    {
+        return -EINVAL;
+    }
+
+    //there is no write-back
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE))
+    {
+        return -EINVAL;
+    }
+
+    if((fd < 0) || (fd >= NR_OPEN) || (!(f = current -> filp[fd])))
+    {
+        return -EBADF;
+    }
+
+    inode = f -> f_inode;
+
+    if((!inode) || (!S_ISREG(inode -> i_mode)) || ((f -> f_flags & O_ACCMODE) == O_WRONLY))
+    {
+        return -EACCES;
+    }
+
+    if(flags & MAP_FIXED)
+    {
+        if((addr & (PAGE_SIZE - 1)) || (addr < MMAP_BASE) || (addr + len > MMAP_END) || (addr + len < addr))
+        {
+            return -EINVAL;
+        }
+
+        if(unmap_areas(addr,addr + len))
+        {
+            return -ENOMEM;
+        }
+    }
+    else if((len > MMAP_END - MMAP_BASE) || (!(addr = get_unmapped_area(len))))
+    {
+        return -ENOMEM;
+    }
+
+    if(!(vma = new_vma(addr,addr + len,prot & (VM_READ | VM_WRITE | VM_EXEC),VMA_FILE,inode,offset)))
+    {
+        return -ENOMEM;
+    }
+
+    insert_vma(vma);
+
+    if(current -> mlock & MCL_FUTURE)
+    {
+        make_pages_present(addr,addr + len,prot & PROT_WRITE);
+    }
+
+    return addr;
+}
+
+int64_t sys_munmap(ulong addr,ulong len)
+{
+    len = VMA_ALIGN(len);
+
+    if((addr & (PAGE_SIZE - 1)) || (!len) || (addr < MMAP_BASE) || (addr + len > MMAP_END) || (addr + len < addr))
+    {
+        return -EINVAL;
+    }
+
+    return unmap_areas(addr,addr + len);
+}
+
+//Resolve every page of the task up front,writable areas into private writable pages,so that it takes no more faults.
+//Text is faulted in for reading,so it stays shared with other tasks running the binary.
+//The pages stay out of swap and reclaim until munlockall(),exec or exit.A fork() makes them copy-on-write again.
+//Only the superuser may pin memory,there is no limit a task could be held to
+int64_t sys_mlockall(int flags)
+{
+    struct vm_area_struct *vma;
+    ulong sp = trap_info.regs[reg_sp] & ~(PAGE_SIZE - 1);
+
+    if((!flags) || (flags & ~(MCL_CURRENT | MCL_FUTURE)))
+    {
+        return -EINVAL;
+    }
+
+    if(!suser())
+    {
+        return -EPERM;
+    }
+
+    current -> mlock = flags;
+
+    if(!(flags & MCL_CURRENT))
+    {
+        return 0;
+    }
+
+    if(!current -> mmap)
+    {
+        make_pages_present(current -> start_code,current -> end_code,false);
+        make_pages_present(current -> end_code,current -> brk,true);
+        make_pages_present(sp - MLOCK_STACK_RESERVE,current -> data_base + current -> data_limit,true);
+        return 0;
+    }
+
+    for(vma = current -> mmap;vma;vma = vma -> vm_next)
+    {
+        if((vma -> vm_flags & VM_GROWSDOWN) && (vma -> vm_start > MLOCK_STACK_RESERVE))
+        {
+            expand_stack(vma -> vm_start - MLOCK_STACK_RESERVE);
+        }
+
+        //text vmas are writable like all memory of the old layout,a write fault would copy every text page
+        make_pages_present(vma -> vm_start,vma -> vm_end,(vma -> vm_type != VMA_TEXT) && (vma -> vm_flags & VM_WRITE));
+    }
+
+    return 0;
+}
+
+int64_t sys_munlockall()
+{
+    current -> mlock = 0;
+    return 0;
+}
+
+static void file_page_in(struct vm_area_struct *vma,ulong address)
+{
+    struct m_inode *inode = vma -> vm_inode;
+    volatile pte_sv39 *pte;
+    ulong page,pos,i;
+    int nr[4];
+
+    if(!(page = get_free_page()))
+    {
+        oom();
+    }
+
+    pos = vma -> vm_offset + address - vma -> vm_start;
+
+    for(i = 0;i < 4;i++)
+    {
+        nr[i] = (pos + i * BLOCK_SIZE < inode -> i_size) ? bmap(inode,(pos / BLOCK_SIZE) + i) : 0;
+    }
+
+    bread_page(page,inode -> i_dev,nr);
+
+    //the tail of the last page is beyond the end of file
+    if(pos + PAGE_SIZE > inode -> i_size)
+    {
+        i = (pos < inode -> i_size) ? inode -> i_size - pos : 0;
+        memset((void *)(page + i),0,PAGE_SIZE - i);
+    }
+
+    if(!put_page(page,address))
+    {
+        free_page(page);
+        oom();
+    }
+
+    if(!(vma -> vm_flags & VM_WRITE))
+    {
+        pte = get_page_entry(address);
+        pte -> w = 0;
+        flush_tlb_page(address);
+    }
+}
+
+//Fault in a page of a file area.MADV_SEQUENTIAL areas map the next pages as well,
+//and unless the area is MADV_RANDOM the blocks behind are read ahead for the next fault
+void do_file_page(struct vm_area_struct *vma,ulong address)
+{
+    ulong end,blocks;
+
+    address &= ~(PAGE_SIZE - 1);
+    file_page_in(vma,address);
+    end = address + PAGE_SIZE;
+
+    if(vma -> vm_flags & VM_SEQ_READ)
+    {
+        for(;(end < vma -> vm_end) && (end < address + FAULT_AROUND_PAGES * PAGE_SIZE) && (!page_mapped(end));end += PAGE_SIZE)
+        {
+            file_page_in(vma,end);
+        }
+    }
+
+    if((!(vma -> vm_flags & VM_RAND_READ)) && (end < vma -> vm_end))
+    {
+        blocks = (vma -> vm_flags & VM_SEQ_READ) ? READAHEAD_SEQ_BLOCKS : READAHEAD_BLOCKS;
+        inode_readahead(vma -> vm_inode,(vma -> vm_offset + end - vma -> vm_start) / BLOCK_SIZE,blocks);
+    }
+}
+
+//for debug only
+void show_vma()
+{
+    static const char *type_name[] = {"text","data","heap","stack","file"};
+    struct vm_area_struct *vma;
+
+    for(vma = current -> mmap;vma;vma = vma -> vm_next)
+    {
+        printk("%p-%p %c%c%c %s\r\n",vma -> vm_start,vma -> vm_end,(vma -> vm_flags & VM_READ) ? 'r' : '-',(vma -> vm_flags & VM_WRITE) ? 'w' : '-',(vma -> vm_flags & VM_EXEC) ? 'x' : '-',type_name[vma -> vm_type]);
+    }
+}
@@ -0,0 +1,329 @@
+#include "common.h"
+#include "linux/kernel.h"
+#include "linux/mm.h"
+
+//Slab allocator for kernel objects.
+//A slab is one page:struct slab,a free index per object,then the objects.
+//The header is found by masking an object address,so slab objects are never page aligned.
+//kmalloc() requests above KMALLOC_MAX_SIZE get whole pages behind a struct kmalloc_large header.
+
+#define NR_KMEM_CACHE 24
+#define SLAB_MAGIC 0x534C4142UL
+#define KMALLOC_LARGE_MAGIC 0x4C415247UL
+#define SLAB_ALIGN 8
+#define SLAB_END 0xFF//end of free index chain,so at most 254 objects per slab
+#define KMALLOC_MIN_SHIFT 4
+#define KMALLOC_MAX_SHIFT 10
+#define KMALLOC_MAX_SIZE (1UL << KMALLOC_MAX_SHIFT)
+
+struct slab
+{
+    ulong magic;
+    struct kmem_cache *cache;
+    struct slab *prev;
+    struct slab *next;
+    ulong inuse;
+    ulong free;//first free object index
+    uint8_t bufctl[];//next free index of each object
+};
+
+struct kmalloc_large
+{
+    ulong magic;
+    ulong pages;
+};
+
+struct kmem_cache
+{
+    const char *name;
+    ulong size;//object size after alignment
+    ulong num;//objects per slab
+    ulong offset;//first object from slab start
+    void (*ctor)(void *);
+    struct slab *partial;
+    struct slab *full;
+    struct slab *empty;//at most one is kept,the rest go back to the page allocator
+    ulong slabs;
+    ulong active;
+    ulong allocs;
+    ulong frees;
+};
+
+static struct kmem_cache cache_table[NR_KMEM_CACHE];
+static struct kmem_cache *kmalloc_caches[KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1];
+static const char *kmalloc_names[KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1] = {"kmalloc-16","kmalloc-32","kmalloc-64","kmalloc-128","kmalloc-256","kmalloc-512","kmalloc-1024"};
+static ulong kmalloc_large_pages = 0;
+
+static inline void *slab_object(struct kmem_cache *cachep,struct slab *slabp,ulong index)
+{
+    return (void *)(((ulong)slabp) + cachep -> offset + index * cachep -> size);
+}
+
+static void slab_list_del(struct slab **list,struct slab *slabp)
+{
+    if(slabp -> prev)
+    {
+        slabp -> prev -> next = slabp -> next;
+    }
+    else
+    {
+        *list = slabp -> next;
+    }
+
+    if(slabp -> next)
+    {
+        slabp -> next -> prev = slabp -> prev;
+    }
+}
+
+static void slab_list_add(struct slab **list,struct slab *slabp)
+{
+    slabp -> prev = NULL;
+    slabp -> next = *list;
+
+    if(*list)
+    {
+        (*list) -> prev = slabp;
+    }
+
+    *list = slabp;
+}
+
+struct kmem_cache *kmem_cache_create(const char *name,ulong size,void (*ctor)(void *))
+{
+    struct kmem_cache *cachep;
+    ulong num;
+
+    for(cachep = cache_table;(cachep < cache_table + NR_KMEM_CACHE) && cachep -> name;cachep++);
+
+    if(cachep >= cache_table + NR_KMEM_CACHE)
+    {
+        return NULL;
+    }
+
+    size = (size + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1);
+    num = (PAGE_SIZE - sizeof(struct slab)) / (size + 1);
+
+    if(num > SLAB_END - 1)
+    {
+        num = SLAB_END - 1;
+    }
+
+    if(!num)
+    {
+        return NULL;
+    }
+
+    memset(cachep,0,sizeof(struct kmem_cache));
+    cachep -> name = name;
+    cachep -> size = size;
+    cachep -> num = num;
+    cachep -> offset = (sizeof(struct slab) + num + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1);
+
+    //the index array may have pushed the last object out of the page
+    if(cachep -> offset + num * size > PAGE_SIZE)
+    {
+        cachep -> num = --num;
+    }
+
+    cachep -> ctor = ctor;
+    return cachep;
+}
+
+static struct slab *kmem_cache_grow(struct kmem_cache *cachep)
+{
+    struct slab *slabp;
+    ulong i;
+
+    if(!(slabp = (struct slab *)get_free_page()))
+    {
+        return NULL;
+    }
+
+    slabp -> magic = SLAB_MAGIC;
+    slabp -> cache = cachep;
+    slabp -> inuse = 0;
+    slabp -> free = 0;
+
+    for(i = 0;i < cachep -> num;i++)
+    {
+        slabp -> bufctl[i] = i + 1;
+
+        if(cachep -> ctor)
+        {
+            cachep -> ctor(slab_object(cachep,slabp,i));
+        }
+    }
+
+    slabp -> bufctl[cachep -> num - 1] = SLAB_END;
+    slab_list_add(&cachep -> empty,slabp);
+    cachep -> slabs++;
+    return slabp;
+}
+
+//Objects are handed out in their constructed state,callers must give them back that way
+void *kmem_cache_alloc(struct kmem_cache *cachep)
+{
+    struct slab *slabp;
+    void *objp;
+
+    if((slabp = cachep -> partial))
+    {
+        slab_list_del(&cachep -> partial,slabp);
+    }
+    else if((slabp = cachep -> empty) || (slabp = kmem_cache_grow(cachep)))
+    {
+        slab_list_del(&cachep -> empty,slabp);
+    }
+    else
+    {
+        return NULL;
+    }
+
+    objp = slab_object(cachep,slabp,slabp -> free);
+    slabp -> free = slabp -> bufctl[slabp -> free];
+    slab_list_add((++slabp -> inuse == cachep -> num) ? &cachep -> full : &cachep -> partial,slabp);
+    cachep -> active++;
+    cachep -> allocs++;
+    return objp;
+}
+
+void kmem_cache_free(struct kmem_cache *cachep,void *objp)
+{
+    struct slab *slabp = (struct slab *)(((ulong)objp) & ~(PAGE_SIZE - 1));
+    ulong index = (((ulong)objp) - ((ulong)slabp) - cachep -> offset) / cachep -> size;
+
+    if((slabp -> magic != SLAB_MAGIC) || (slabp -> cache != cachep) || (slab_object(cachep,slabp,index) != objp))
+    {
+        panic("kmem_cache_free:bad object");
+    }
+
+    slab_list_del((slabp -> inuse == cachep -> num) ? &cachep -> full : &cachep -> partial,slabp);
+    slabp -> bufctl[index] = slabp -> free;
+    slabp -> free = index;
+    cachep -> active--;
+    cachep -> frees++;
+
+    if(--slabp -> inuse)
+    {
+        slab_list_add(&cachep -> partial,slabp);
+    }
+    else if(!cachep -> empty)
+    {
+        slab_list_add(&cachep -> empty,slabp);
+    }
+    else
+    {
+        slabp -> magic = 0;
+        cachep -> slabs--;
+        free_page((ulong)slabp);
+    }
+}
+
+//Give empty slabs back to the page allocator,returns the number of pages freed
+ulong kmem_cache_reap()
+{
+    struct kmem_cache *cachep;
+    struct slab *slabp;
+    ulong freed = 0;
+
+    for(cachep = cache_table;cachep < cache_table + NR_KMEM_CACHE;cachep++)
+    {
+        while((slabp = cachep -> empty))
+        {
+            slab_list_del(&cachep -> empty,slabp);
+            slabp -> magic = 0;
+            cachep -> slabs--;
+            free_page((ulong)slabp);
+            freed++;
+        }
+    }
+
+    return freed;
+}
+
+void *kmalloc(ulong size)
+{
+    ulong shift = KMALLOC_MIN_SHIFT;
+    struct kmalloc_large *large;
+    ulong pages;
+
+    if(size > KMALLOC_MAX_SIZE)
+    {
+        pages = (size + sizeof(struct kmalloc_large) + PAGE_SIZE - 1) >> PAGING_SHIFT;
+
+        if(!(large = (struct kmalloc_large *)get_free_pages(pages)))
+        {
+            return NULL;
+        }
+
+        large -> magic = KMALLOC_LARGE_MAGIC;
+        large -> pages = pages;
+        kmalloc_large_pages += pages;
+        return (void *)(large + 1);
+    }
+
+    while((1UL << shift) < size)
+    {
+        shift++;
+    }
+
+    return kmem_cache_alloc(kmalloc_caches[shift - KMALLOC_MIN_SHIFT]);
+}
+
+void kfree(void *objp)
+{
+    struct slab *slabp = (struct slab *)(((ulong)objp) & ~(PAGE_SIZE - 1));
+    struct kmalloc_large *large = (struct kmalloc_large *)slabp;
+
+    if(!objp)
+    {
+        return;
+    }
+
+    if(slabp -> magic == SLAB_MAGIC)
+    {
+        kmem_cache_free(slabp -> cache,objp);
+    }
+    else if((large -> magic == KMALLOC_LARGE_MAGIC) && ((void *)(large + 1) == objp))
+    {
+        large -> magic = 0;
+        kmalloc_large_pages -= large -> pages;
+        free_pages((ulong)large,large -> pages);
+    }
+    else
+    {
+        panic("kfree:bad pointer");
+    }
+}
+
+void kmem_cache_init()
+{
+    ulong i;
+
+    for(i = 0;i <= KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT;i++)
+    {
+        if(!(kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i],1UL << (i + KMALLOC_MIN_SHIFT),NULL)))
+        {
+            panic("kmem_cache_init:can't create kmalloc caches");
+        }
+    }
+}
+
+//for debug only
+void show_slab()
+{
+    struct kmem_cache *cachep;
+
+    printk("slab:name objsize active/total slabs allocs frees\r\n");
+
+    for(cachep = cache_table;cachep < cache_table + NR_KMEM_CACHE;cachep++)
+    {
+        if(cachep -> name)
+        {
+            printk("slab:%s %lu %lu/%lu %lu %lu %lu\r\n",cachep -> name,cachep -> size,cachep -> active,cachep -> slabs * cachep -> num,cachep -> slabs,cachep -> allocs,cachep -> frees);
+        }
+    }
+
+    printk("slab:%lu pages in large kmalloc blocks\r\n",kmalloc_large_pages);
+}
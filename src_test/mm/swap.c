@@ -0,0 +1,691 @@
+#include "common.h"
+#include "linux/kernel.h"
+#include "linux/mm.h"
+#include "linux/sched.h"
+
+//Compressed in-memory swap.
+//There is no backing store on this board,so anonymous pages are compressed into
+//pool pages carved from normal memory instead of being written out.A swapped
+//entry keeps v = 0,rsw = PTE_RSW_SWAP and the slot index in its ppn field.
+//Clean pages read from a file are cheaper to drop than to compress,so drop_clean_page() runs first.
+
+#define SWAP_SLOT_NUM 512//Max swapped pages
+#define SWAP_POOL_PAGES 128//Max pool pages(512KB)
+#define SWAP_CHUNK_SHIFT 6
+#define SWAP_CHUNK_SIZE (1UL << SWAP_CHUNK_SHIFT)
+#define SWAP_CHUNK_NUM (PAGE_SIZE >> SWAP_CHUNK_SHIFT)//64 chunks,so one ulong bitmap per pool page
+#define SWAP_MAX_COMPRESSED (PAGE_SIZE * 3 / 4)//Pages which don't shrink below this stay resident
+#define SWAP_SCAN_MAX (PAGING_PAGES * 2)//Entries looked at per swap_out() call
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 10
+
+struct swap_slot
+{
+    uint8_t count;//page table references,0 if the slot is free
+    uint8_t same;//page is one repeated word,kept in value without pool space
+    uint16_t pool;
+    uint16_t chunk;
+    uint16_t size;//compressed size in bytes
+    ulong value;
+};
+
+static struct swap_slot swap_slots[SWAP_SLOT_NUM];
+static ulong swap_slot_hint = 0;
+static ulong swap_pool[SWAP_POOL_PAGES];
+static ulong swap_pool_map[SWAP_POOL_PAGES];//chunk bitmap of each pool page
+
+static uint8_t swap_buffer[PAGE_SIZE];//compress bounce buffer
+static uint16_t lz_hash_table[1 << LZ_HASH_BITS];
+
+static ulong swap_scan_task = 1;//clock hand:task index and address inside it
+static ulong swap_scan_addr = USER_START_ADDR;
+static bool swap_busy = false;
+static ulong drop_scan_task = 1;
+static ulong drop_scan_addr = USER_START_ADDR;
+
+struct swap_stat swap_stat;
+
+static inline uint32_t lz_read32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline ulong lz_hash(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static bool lz_put_length(uint8_t **op,uint8_t *oend,ulong len)
+{
+    for(;len >= 255;len -= 255)
+    {
+        if(*op >= oend)
+        {
+            return false;
+        }
+
+        *(*op)++ = 255;
+    }
+
+    if(*op >= oend)
+    {
+        return false;
+    }
+
+    *(*op)++ = len;
+    return true;
+}
+
+//Sequence:token(literal length:4,match length:4),[length],literals,[offset:16,[length]]
+//The last sequence has literals only
+static bool lz_emit(uint8_t **op,uint8_t *oend,const uint8_t *lit,ulong litlen,ulong offset,ulong matchlen)
+{
+    uint8_t *token;
+
+    if(*op >= oend)
+    {
+        return false;
+    }
+
+    token = (*op)++;
+    *token = ((litlen >= 15 ? 15 : litlen) << 4) | (matchlen >= 15 ? 15 : matchlen);
+
+    if((litlen >= 15) && !lz_put_length(op,oend,litlen - 15))
+    {
+        return false;
+    }
+
+    if((ulong)(oend - *op) < litlen)
+    {
+        return false;
+    }
+
+    memcpy(*op,lit,litlen);
+    *op += litlen;
+
+    if(!offset)
+    {
+        return true;
+    }
+
+    if(oend - *op < 2)
+    {
+        return false;
+    }
+
+    *(*op)++ = offset & 0xFF;
+    *(*op)++ = offset >> 8;
+    return (matchlen < 15) || lz_put_length(op,oend,matchlen - 15);
+}
+
+//Compress one page into out,returns compressed size or 0 if it doesn't fit in limit bytes
+ulong lz_compress_page(const uint8_t *in,uint8_t *out,ulong limit)
+{
+    const uint8_t *ip = in;
+    const uint8_t *anchor = in;
+    const uint8_t *end = in + PAGE_SIZE;
+    const uint8_t *ref,*mp;
+    uint8_t *op = out;
+    uint32_t v;
+    ulong h;
+
+    memset(lz_hash_table,0,sizeof(lz_hash_table));
+
+    while(ip <= end - LZ_MIN_MATCH)
+    {
+        v = lz_read32(ip);
+        h = lz_hash(v);
+        ref = in + lz_hash_table[h];
+        lz_hash_table[h] = ip - in;
+
+        if((ref >= ip) || (lz_read32(ref) != v))
+        {
+            ip++;
+            continue;
+        }
+
+        for(mp = ip + LZ_MIN_MATCH,ref += LZ_MIN_MATCH;(mp < end) && (*mp == *ref);mp++,ref++);
+
+        if(!lz_emit(&op,out + limit,anchor,ip - anchor,mp - ref,(mp - ip) - LZ_MIN_MATCH))
+        {
+            return 0;
+        }
+
+        ip = anchor = mp;
+    }
+
+    if(!lz_emit(&op,out + limit,anchor,end - anchor,0,0))
+    {
+        return 0;
+    }
+
+    return op - out;
+}
+
+//Returns false if the input is corrupted
+bool lz_decompress_page(const uint8_t *in,ulong size,uint8_t *out)
+{
+    const uint8_t *ip = in;
+    const uint8_t *iend = in + size;
+    uint8_t *op = out;
+    uint8_t *oend = out + PAGE_SIZE;
+    const uint8_t *ref;
+    ulong token,len,offset;
+    uint8_t c;
+
+    while(ip < iend)
+    {
+        token = *ip++;
+        len = token >> 4;
+
+        if(len == 15)
+        {
+            do
+            {
+                if(ip >= iend)
+                {
+                    return false;
+                }
+
+                c = *ip++;
+                len += c;
+            }while(c == 255);
+        }
+
+        if((len > (ulong)(iend - ip)) || (len > (ulong)(oend - op)))
+        {
+            return false;
+        }
+
+        memcpy(op,ip,len);
+        op += len;
+        ip += len;
+
+        if(ip >= iend)
+        {
+            break;
+        }
+
+        if(iend - ip < 2)
+        {
+            return false;
+        }
+
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        len = token & 15;
+
+        if(len == 15)
+        {
+            do
+            {
+                if(ip >= iend)
+                {
+                    return false;
+                }
+
+                c = *ip++;
+                len += c;
+            }while(c == 255);
+        }
+
+        len += LZ_MIN_MATCH;
+
+        if((offset == 0) || (offset > (ulong)(op - out)) || (len > (ulong)(oend - op)))
+        {
+            return false;
+        }
+
+        //byte by byte,the match may overlap its own output
+        for(ref = op - offset;len-- > 0;)
+        {
+            *op++ = *ref++;
+        }
+    }
+
+    return op == oend;
+}
+
+static long swap_get_slot()
+{
+    ulong i;
+
+    for(i = 0;i < SWAP_SLOT_NUM;i++,swap_slot_hint = (swap_slot_hint + 1) % SWAP_SLOT_NUM)
+    {
+        if(!swap_slots[swap_slot_hint].count)
+        {
+            return swap_slot_hint;
+        }
+    }
+
+    return -1;
+}
+
+static inline ulong swap_chunk_mask(ulong nchunks,ulong chunk)
+{
+    return ((nchunks == SWAP_CHUNK_NUM) ? ~0UL : ((1UL << nchunks) - 1)) << chunk;
+}
+
+//First fit a run of chunks in the existing pool pages
+static long swap_pool_alloc(ulong nchunks,ulong *chunk)
+{
+    ulong i,j,mask;
+
+    for(i = 0;i < SWAP_POOL_PAGES;i++)
+    {
+        if(!swap_pool[i])
+        {
+            continue;
+        }
+
+        for(j = 0;j + nchunks <= SWAP_CHUNK_NUM;j++)
+        {
+            mask = swap_chunk_mask(nchunks,j);
+
+            if(!(swap_pool_map[i] & mask))
+            {
+                swap_pool_map[i] |= mask;
+                *chunk = j;
+                return i;
+            }
+        }
+    }
+
+    return -1;
+}
+
+//Compress the page into a new slot,returns the slot index or -1 if the page should stay resident.
+//When the pool is full the page itself may become a new pool page,*donated tells the caller not to free it.
+static long swap_store(ulong page,bool *donated)
+{
+    long slot,pool;
+    ulong i,size,nchunks,chunk;
+    ulong *w = (ulong *)page;
+    struct swap_slot *s;
+
+    *donated = false;
+
+    if((slot = swap_get_slot()) < 0)
+    {
+        return -1;
+    }
+
+    s = &swap_slots[slot];
+
+    for(i = 1;(i < PAGE_SIZE / sizeof(ulong)) && (w[i] == w[0]);i++);
+
+    if(i == PAGE_SIZE / sizeof(ulong))
+    {
+        s -> count = 1;
+        s -> same = 1;
+        s -> value = w[0];
+        s -> size = 0;
+        swap_stat.same_pages++;
+        return slot;
+    }
+
+    if(!(size = lz_compress_page((const uint8_t *)page,swap_buffer,SWAP_MAX_COMPRESSED)))
+    {
+        swap_stat.rejected++;
+        return -1;
+    }
+
+    nchunks = (size + SWAP_CHUNK_SIZE - 1) >> SWAP_CHUNK_SHIFT;
+
+    if((pool = swap_pool_alloc(nchunks,&chunk)) < 0)
+    {
+        for(pool = 0;(pool < SWAP_POOL_PAGES) && swap_pool[pool];pool++);
+
+        if(pool == SWAP_POOL_PAGES)
+        {
+            return -1;
+        }
+
+        swap_pool[pool] = page;
+        swap_pool_map[pool] = swap_chunk_mask(nchunks,0);
+        chunk = 0;
+        *donated = true;
+        swap_stat.pool_pages++;
+    }
+
+    memcpy((void *)(swap_pool[pool] + (chunk << SWAP_CHUNK_SHIFT)),swap_buffer,size);
+    s -> count = 1;
+    s -> same = 0;
+    s -> pool = pool;
+    s -> chunk = chunk;
+    s -> size = size;
+    swap_stat.stored_bytes += size;
+    return slot;
+}
+
+void swap_free(ulong slot)
+{
+    struct swap_slot *s = &swap_slots[slot];
+
+    if(!s -> count)
+    {
+        panic("swap_free:trying to free free slot");
+    }
+
+    if(--s -> count)
+    {
+        return;
+    }
+
+    if(s -> same)
+    {
+        swap_stat.same_pages--;
+        return;
+    }
+
+    swap_stat.stored_bytes -= s -> size;
+    swap_pool_map[s -> pool] &= ~swap_chunk_mask((s -> size + SWAP_CHUNK_SIZE - 1) >> SWAP_CHUNK_SHIFT,s -> chunk);
+
+    if(!swap_pool_map[s -> pool])
+    {
+        free_page(swap_pool[s -> pool]);
+        swap_pool[s -> pool] = 0;
+        swap_stat.pool_pages--;
+    }
+}
+
+void swap_duplicate(ulong slot)
+{
+    if(swap_slots[slot].count == 0xFF)
+    {
+        panic("swap_duplicate:slot count overflow");
+    }
+
+    swap_slots[slot].count++;
+}
+
+//Try to move one anonymous page of task p at address into the pool
+//Returns 1 if a page was freed
+static int try_to_swap_out(struct task_struct *p,ulong address,volatile pte_sv39 *pte)
+{
+    ulong page = pte_common_ppn_to_addr((volatile pte_64model *)pte);
+    long slot;
+    bool donated;
+
+    //text comes back from the executable,it isn't anonymous
+    if((!pte -> u) || (page_count(page) != 1) || (p -> executable && (address < p -> end_code)))
+    {
+        return 0;
+    }
+
+    //second chance
+    if(pte -> a)
+    {
+        pte -> a = 0;
+        return 0;
+    }
+
+    if((slot = swap_store(page,&donated)) < 0)
+    {
+        return 0;
+    }
+
+    pte_common_init((volatile pte_64model *)pte,1);
+    pte -> rsw = PTE_RSW_SWAP;
+    ((volatile pte_64model *)pte) -> ppn = slot;
+    swap_stat.out++;
+
+    flush_tlb_task_page(p,((ulong)pte) & ~(PAGE_SIZE - 1),address);
+
+    if(donated)
+    {
+        return 0;
+    }
+
+    free_page(page);
+    return 1;
+}
+
+//Walk the page tables of all tasks like a clock,and compress one anonymous page
+//Returns 1 if a page was freed
+int swap_out()
+{
+    ulong scanned = 0;
+    ulong entryid;
+    struct task_struct *p;
+    volatile pte_sv39 *dir,*pte;
+
+    if(swap_busy)
+    {
+        return 0;
+    }
+
+    swap_busy = true;
+
+    while(scanned < SWAP_SCAN_MAX)
+    {
+        p = task[swap_scan_task];
+
+        if((!p) || (!p -> page_dir_table) || (p -> state == TASK_ZOMBIE) || p -> mlock || (swap_scan_addr >= USER_START_ADDR + p -> data_limit))
+        {
+            swap_scan_task = (swap_scan_task + 1) % NR_TASKS;
+            swap_scan_task = swap_scan_task ? swap_scan_task : 1;
+            swap_scan_addr = USER_START_ADDR;
+            scanned++;
+            continue;
+        }
+
+        dir = &p -> page_dir_table[GET_PAGE_DIR_ID(swap_scan_addr)];
+
+        //megapages stay resident
+        if((!dir -> v) || pte_common_is_leaf((volatile pte_64model *)dir))
+        {
+            swap_scan_addr = (swap_scan_addr + PAGING_HIGH_LEVEL_SIZE) & ~(PAGING_HIGH_LEVEL_SIZE - 1);
+            scanned++;
+            continue;
+        }
+
+        pte = (volatile pte_sv39 *)pte_common_ppn_to_addr((volatile pte_64model *)dir);
+
+        for(entryid = GET_PAGE_ENTRY_ID(swap_scan_addr);entryid < PAGE_TABLE_ITEM_NUM;entryid++,scanned++,swap_scan_addr += PAGE_SIZE)
+        {
+            if(pte[entryid].v && try_to_swap_out(p,swap_scan_addr,&pte[entryid]))
+            {
+                swap_scan_addr += PAGE_SIZE;
+                swap_busy = false;
+                return 1;
+            }
+        }
+    }
+
+    swap_busy = false;
+    return 0;
+}
+
+//Compress every anonymous page of task p that try_to_swap_out() takes,
+//twice over so that the first pass spends the second chances.For debug only,returns the pages moved out
+ulong swap_out_task(struct task_struct *p)
+{
+    ulong out = swap_stat.out;
+    ulong addr;
+    int pass;
+    volatile pte_sv39 *dir,*pte;
+
+    if(swap_busy || p -> mlock)
+    {
+        return 0;
+    }
+
+    swap_busy = true;
+
+    for(pass = 0;pass < 2;pass++)
+    {
+        for(addr = USER_START_ADDR;addr < USER_START_ADDR + p -> data_limit;addr += PAGE_SIZE)
+        {
+            dir = &p -> page_dir_table[GET_PAGE_DIR_ID(addr)];
+
+            if((!dir -> v) || pte_common_is_leaf((volatile pte_64model *)dir))
+            {
+                addr = ((addr + PAGING_HIGH_LEVEL_SIZE) & ~(PAGING_HIGH_LEVEL_SIZE - 1)) - PAGE_SIZE;
+                continue;
+            }
+
+            pte = ((volatile pte_sv39 *)pte_common_ppn_to_addr((volatile pte_64model *)dir)) + GET_PAGE_ENTRY_ID(addr);
+
+            if(pte -> v)
+            {
+                try_to_swap_out(p,addr,pte);
+            }
+        }
+    }
+
+    swap_busy = false;
+    return swap_stat.out - out;
+}
+
+//Walk the page tables of all tasks like swap_out(),and unmap clean pages which fault back in from a file.
+//Text,data and mmap() pages qualify while d is clear,user_addr_to_kernel_write() sets it for kernel writes
+//and swap_in() for pages whose contents only live in the pool.A page shared by several tasks is unmapped
+//from each in turn,it is freed with the last one.Returns 1 if a page was freed
+int drop_clean_page()
+{
+    ulong scanned = 0;
+    ulong entryid,page;
+    struct task_struct *p;
+    volatile pte_sv39 *dir,*pte;
+
+    while(scanned < SWAP_SCAN_MAX)
+    {
+        p = task[drop_scan_task];
+
+        if((!p) || (!p -> page_dir_table) || (p -> state == TASK_ZOMBIE) || p -> mlock || (!p -> executable) || (drop_scan_addr >= MMAP_END))
+        {
+            drop_scan_task = (drop_scan_task + 1) % NR_TASKS;
+            drop_scan_task = drop_scan_task ? drop_scan_task : 1;
+            drop_scan_addr = USER_START_ADDR;
+            scanned++;
+            continue;
+        }
+
+        dir = &p -> page_dir_table[GET_PAGE_DIR_ID(drop_scan_addr)];
+
+        if((!dir -> v) || pte_common_is_leaf((volatile pte_64model *)dir))
+        {
+            drop_scan_addr = (drop_scan_addr + PAGING_HIGH_LEVEL_SIZE) & ~(PAGING_HIGH_LEVEL_SIZE - 1);
+            scanned++;
+            continue;
+        }
+
+        pte = (volatile pte_sv39 *)pte_common_ppn_to_addr((volatile pte_64model *)dir);
+
+        for(entryid = GET_PAGE_ENTRY_ID(drop_scan_addr);entryid < PAGE_TABLE_ITEM_NUM;entryid++,scanned++,drop_scan_addr += PAGE_SIZE)
+        {
+            if((!pte[entryid].v) || (!pte[entryid].u) || pte[entryid].d || (!vma_file_backed(p,drop_scan_addr)))
+            {
+                continue;
+            }
+
+            //second chance
+            if(pte[entryid].a)
+            {
+                pte[entryid].a = 0;
+                continue;
+            }
+
+            page = pte_common_ppn_to_addr((volatile pte_64model *)&pte[entryid]);
+            pte_common_init((volatile pte_64model *)&pte[entryid],1);
+            flush_tlb_task_page(p,(ulong)pte,drop_scan_addr);
+
+            if(page_count(page) == 1)
+            {
+                free_page(page);
+                drop_scan_addr += PAGE_SIZE;
+                swap_stat.dropped++;
+                return 1;
+            }
+
+            free_page(page);
+        }
+    }
+
+    return 0;
+}
+
+//Bring a swapped page of the current task back,returns false if address isn't swapped
+bool swap_in(ulong address)
+{
+    volatile pte_sv39 *dir = &cur_page_dir_table[GET_PAGE_DIR_ID(address)];
+    volatile pte_sv39 *pte;
+    struct swap_slot *s;
+    ulong slot,page,i;
+    ulong start = core_get_cycle();
+
+    if((!dir -> v) || pte_common_is_leaf((volatile pte_64model *)dir))
+    {
+        return false;
+    }
+
+    pte = ((volatile pte_sv39 *)pte_common_ppn_to_addr((volatile pte_64model *)dir)) + GET_PAGE_ENTRY_ID(address);
+
+    if(!PTE_IS_SWAP(pte))
+    {
+        return false;
+    }
+
+    slot = ((volatile pte_64model *)pte) -> ppn;
+    s = &swap_slots[slot];
+
+    if(!(page = get_free_page()))
+    {
+        oom();
+    }
+
+    //the table may still be shared with a forked task,which keeps its own reference to the slot
+    pte = get_page_entry(address);
+
+    if(s -> same)
+    {
+        for(i = 0;i < PAGE_SIZE / sizeof(ulong);i++)
+        {
+            ((ulong *)page)[i] = s -> value;
+        }
+    }
+    else if(!lz_decompress_page((const uint8_t *)(swap_pool[s -> pool] + (s -> chunk << SWAP_CHUNK_SHIFT)),s -> size,(uint8_t *)page))
+    {
+        panic("swap_in:corrupted swap slot");
+    }
+
+    swap_free(slot);
+    pte_common_init((volatile pte_64model *)pte,1);
+    pte_common_addr_to_ppn((volatile pte_64model *)pte,page);
+    pte_common_set_accessibility((volatile pte_64model *)pte,pte_accessibility_all);
+    pte_common_enable_user((volatile pte_64model *)pte);
+    pte_common_enable_entry((volatile pte_64model *)pte);
+    pte -> d = 1;//the contents aren't in any file
+    flush_tlb_page(address);
+
+    start = core_get_cycle() - start;
+    swap_stat.in++;
+    swap_stat.in_cycles += start;
+
+    if(start > swap_stat.in_cycles_max)
+    {
+        swap_stat.in_cycles_max = start;
+    }
+
+    return true;
+}
+
+//for debug only
+void show_swap()
+{
+    ulong used = 0,i;
+
+    for(i = 0;i < SWAP_SLOT_NUM;i++)
+    {
+        if(swap_slots[i].count && !swap_slots[i].same)
+        {
+            used++;
+        }
+    }
+
+    printk("swap:%lu compressed pages in %lu bytes,%lu same-filled pages,%lu pool pages\r\n",used,swap_stat.stored_bytes,swap_stat.same_pages,swap_stat.pool_pages);
+    printk("swap:out %lu,in %lu,rejected %lu,clean file pages dropped %lu\r\n",swap_stat.out,swap_stat.in,swap_stat.rejected,swap_stat.dropped);
+    printk("swap:swap-in latency avg %lu,max %lu cycles\r\n",swap_stat.in ? swap_stat.in_cycles / swap_stat.in : 0,swap_stat.in_cycles_max);
+}
@@ -0,0 +1,247 @@
+#include "common.h"
+#include "linux/sched.h"
+#include "linux/kernel.h"
+#include "linux/mm.h"
+#include "linux/fs.h"
+
+//Sticky text.
+//Text pages read from an executable are kept here by inode after the last task running it exits,
+//so exec of a recently used binary maps the resident pages instead of reading them again.
+//The cache holds a reference to each page and to the inode,cached pages are mapped read-only
+//and copied by un_wp_page() if a task writes to its text.Pages nobody maps are given back under
+//memory pressure,a write,truncate or unlink of the file or an umount of its device drops its entry
+
+#define NR_TEXT_CACHE 8
+#define TEXT_CACHE_PAGES (PAGE_SIZE / sizeof(ulong))//the index is one page,so up to 2MB of text per executable
+
+struct text_cache
+{
+    struct m_inode *inode;
+    ulong *page;//physical address of each text page,0 if not cached
+    ulong pages;
+    ulong last_used;//jiffies
+};
+
+static struct text_cache text_cache[NR_TEXT_CACHE];
+struct text_cache_stat text_cache_stat;
+
+static struct text_cache *text_cache_lookup(struct m_inode *inode)
+{
+    struct text_cache *tc;
+
+    for(tc = text_cache;tc < text_cache + NR_TEXT_CACHE;tc++)
+    {
+        if(tc -> inode == inode)
+        {
+            return tc;
+        }
+    }
+
+    return NULL;
+}
+
+//Drop every page of the entry,the pages stay with the tasks that map them
+static void text_cache_free_pages(struct text_cache *tc)
+{
+    ulong i;
+
+    if(!tc -> page)
+    {
+        return;
+    }
+
+    for(i = 0;i < TEXT_CACHE_PAGES;i++)
+    {
+        if(tc -> page[i])
+        {
+            free_page(tc -> page[i]);
+        }
+    }
+
+    free_page((ulong)tc -> page);
+    tc -> page = NULL;
+    tc -> pages = 0;
+}
+
+//Return the cached page index of inode with a new reference,or 0
+ulong text_cache_find(struct m_inode *inode,ulong index)
+{
+    struct text_cache *tc;
+    ulong page;
+
+    if((index >= TEXT_CACHE_PAGES) || (!(tc = text_cache_lookup(inode))) || (!tc -> page) || (!(page = tc -> page[index])))
+    {
+        return 0;
+    }
+
+    get_page(page);
+    tc -> last_used = jiffies;
+    text_cache_stat.hits++;
+    return page;
+}
+
+//Keep a freshly read text page,gen is the i_text_gen of inode before the read.Returns true if the cache took a reference to it
+bool text_cache_add(struct m_inode *inode,ulong index,ulong page,uint32_t gen)
+{
+    struct text_cache *tc,*victim = NULL;
+    struct m_inode *old;
+
+    //an unlinked file was already invalidated,caching it again would keep its blocks until reboot
+    //and a file written while the page was read may have changed under it
+    if((index >= TEXT_CACHE_PAGES) || (!inode -> i_nlinks) || (inode -> i_text_gen != gen))
+    {
+        return false;
+    }
+
+    if(!(tc = text_cache_lookup(inode)))
+    {
+        //a free slot,or else the least recently used binary nobody runs
+        for(tc = text_cache;tc < text_cache + NR_TEXT_CACHE;tc++)
+        {
+            if(!tc -> inode)
+            {
+                victim = tc;
+                break;
+            }
+
+            if((tc -> inode -> i_count == 1) && ((!victim) || (tc -> last_used < victim -> last_used)))
+            {
+                victim = tc;
+            }
+        }
+
+        if(!(tc = victim))
+        {
+            return false;
+        }
+
+        //take the slot before iput(),which may sleep
+        old = tc -> inode;
+        text_cache_free_pages(tc);
+        tc -> inode = inode;
+        tc -> last_used = jiffies;
+        inode -> i_count++;
+
+        if(old)
+        {
+            iput(old);
+        }
+    }
+
+    //no reclaim here,it could take the entry we are filling
+    if((!tc -> page) && (!(tc -> page = (ulong *)get_zone_pages(ZONES_ALL,1))))
+    {
+        return false;
+    }
+
+    if(tc -> page[index])
+    {
+        return false;
+    }
+
+    tc -> page[index] = page;
+    tc -> pages++;
+    tc -> last_used = jiffies;
+    get_page(page);
+    text_cache_stat.added++;
+    return true;
+}
+
+//Give back cached pages no task maps,from the least recently used binary that has some.Returns the number of pages freed.
+//The inode is kept,iput() may sleep and this runs from the allocator
+ulong text_cache_reap()
+{
+    struct text_cache *tc,*victim;
+    ulong i,tries,freed = 0;
+    ulong tried = 0;//bit per entry
+
+    for(tries = 0;(tries < NR_TEXT_CACHE) && (!freed);tries++)
+    {
+        victim = NULL;
+
+        for(tc = text_cache;tc < text_cache + NR_TEXT_CACHE;tc++)
+        {
+            if(tc -> page && (!(tried & (1UL << (tc - text_cache)))) && ((!victim) || (tc -> last_used < victim -> last_used)))
+            {
+                victim = tc;
+            }
+        }
+
+        if(!victim)
+        {
+            break;
+        }
+
+        tried |= 1UL << (victim - text_cache);
+
+        for(i = 0;i < TEXT_CACHE_PAGES;i++)
+        {
+            if(victim -> page[i] && (page_count(victim -> page[i]) == 1))
+            {
+                free_page(victim -> page[i]);
+                victim -> page[i] = 0;
+                victim -> pages--;
+                freed++;
+            }
+        }
+
+        if(!victim -> pages)
+        {
+            free_page((ulong)victim -> page);
+            victim -> page = NULL;
+            freed++;
+        }
+    }
+
+    text_cache_stat.reaped += freed;
+    return freed;
+}
+
+//The file is changing or going away,forget its text
+void text_cache_invalidate(struct m_inode *inode)
+{
+    struct text_cache *tc;
+
+    //even if not cached,a page being read for the cache is now stale
+    inode -> i_text_gen++;
+
+    if(!(tc = text_cache_lookup(inode)))
+    {
+        return;
+    }
+
+    text_cache_free_pages(tc);
+    tc -> inode = NULL;
+    text_cache_stat.invalidated++;
+    iput(inode);
+}
+
+//The device is being unmounted,its cached binaries must not keep their inodes busy
+void text_cache_invalidate_dev(int dev)
+{
+    struct text_cache *tc;
+
+    for(tc = text_cache;tc < text_cache + NR_TEXT_CACHE;tc++)
+    {
+        if(tc -> inode && (tc -> inode -> i_dev == dev))
+        {
+            text_cache_invalidate(tc -> inode);
+        }
+    }
+}
+
+//for debug only
+void show_text_cache()
+{
+    struct text_cache *tc;
+
+    printk("text cache:%lu hits,%lu pages added,%lu reaped,%lu files invalidated\r\n",text_cache_stat.hits,text_cache_stat.added,text_cache_stat.reaped,text_cache_stat.invalidated);
+
+    for(tc = text_cache;tc < text_cache + NR_TEXT_CACHE;tc++)
+    {
+        if(tc -> inode)
+        {
+            printk("text cache:inode %04x:%d,%lu pages,%d users\r\n",tc -> inode -> i_dev,tc -> inode -> i_num,tc -> pages,tc -> inode -> i_count - 1);
+        }
+    }
+}
@@ -2,12 +2,14 @@
 #define __PAGE_TABLE_H__
 
     #define PAGE_ROOT_TABLE_NUM 8UL
-    #define PAGE_DIR_TABLE_NUM 512UL * 4UL
+    #define PAGE_DIR_TABLE_NUM 512UL//page_root_table[3] maps 1GB,so one page of directory covers all of user space
     //#define PAGE_TABLE_NUM 8
     #define PAGE_TABLE_ITEM_NUM 512UL
 
     extern volatile pte_sv39 page_root_table[PAGE_ROOT_TABLE_NUM];
-    extern volatile pte_sv39 *page_dir_table;
+    extern volatile pte_sv39 *core_page_dir_table[CORE_NUM];
+    #define cur_page_dir_table (core_page_dir_table[current_coreid()])//the directory loaded on the hart running this code
+    extern volatile pte_sv39 *core_page_root[CORE_NUM];//root table of each hart,used by the tasks if there are no ASIDs
     //extern volatile pte_sv39 page_table[PAGE_TABLE_NUM][PAGE_TABLE_ITEM_NUM];
 
 #endif
\ No newline at end of file
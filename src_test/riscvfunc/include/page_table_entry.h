@@ -12,7 +12,7 @@
         ulong g : 1;//It designates a global mapping
         ulong a : 1;//Accessed Status
         ulong d : 1;//Dirty Status
-        ulong : 2;
+        ulong rsw : 2;//Reserved for supervisor software
         ulong ppn0 : 9;//Physical Page Number 0
         ulong ppn1 : 9;//Physical Page Number 1
         ulong ppn2 : 20;//Physical Page Number 2
@@ -30,7 +30,7 @@
         ulong g : 1;//It designates a global mapping
         ulong a : 1;//Accessed Status
         ulong d : 1;//Dirty Status
-        ulong : 2;
+        ulong rsw : 2;//Reserved for supervisor software
         ulong ppn0 : 9;//Physical Page Number 0
         ulong ppn1 : 9;//Physical Page Number 1
         ulong ppn2 : 9;//Physical Page Number 2
@@ -49,7 +49,7 @@
         ulong g : 1;//It designates a global mapping
         ulong a : 1;//Accessed Status
         ulong d : 1;//Dirty Status
-        ulong : 2;
+        ulong rsw : 2;//Reserved for supervisor software
         ulong ppn : 38;//Physical Page Number
         ulong : 16;
     }ALIGN4BYTE pte_64model;
@@ -73,12 +73,18 @@
     #define PTE_OFFSET_G 5
     #define PTE_OFFSET_A 6
     #define PTE_OFFSET_D 7
+    #define PTE_OFFSET_RSW 8
     #define PTE_OFFSET_PPN 10
 
     #define PTE_OFFSETBASE_ACCESSIBILITY 1
 
+    //Software flags kept in rsw
+    #define PTE_RSW_SWAP 1//v = 0,ppn holds a compressed swap slot
+
     #define PTE_ADDR_OFFSET_LENGTH 12
 
+    #define SPTBR_ASID_BITS 26//width of the asid field of sptbr
+
     typedef enum pte_mode
     {
         pte_mode_none = 0,
@@ -95,10 +101,14 @@
     void pte_common_enable_user(volatile pte_64model *pte);
     void pte_common_disable_user(volatile pte_64model *pte);
     void pte_common_set_writeable(volatile pte_64model *pte);
+    bool pte_common_is_leaf(volatile pte_64model *pte);
     void pte_entry_sv39();
     void pte_entry_sv48();
     void pte_exit();
     void pte_refresh_tlb();
+    void pte_refresh_tlb_addr(ulong addr);
     void pte_set_root_page_table(volatile pte_64model *pte);
+    ulong pte_asid_bits();
+    void pte_set_root_page_table_asid(volatile pte_64model *pte,ulong asid);
 
 #endif
\ No newline at end of file
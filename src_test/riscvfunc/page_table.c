@@ -2,5 +2,6 @@
 #include "linux/sched.h"
 
 volatile pte_sv39 page_root_table[PAGE_ROOT_TABLE_NUM] ALIGN4K;
-volatile pte_sv39 *page_dir_table;
+volatile pte_sv39 *core_page_dir_table[CORE_NUM];
+volatile pte_sv39 *core_page_root[CORE_NUM] = {page_root_table};
 //volatile pte_sv39 page_table[PAGE_TABLE_NUM][PAGE_TABLE_ITEM_NUM] ALIGN4K;
\ No newline at end of file
@@ -48,6 +48,12 @@ void pte_common_set_writeable(volatile pte_64model *pte)
     pte -> w = 1;
 }
 
+//A valid entry with any of r/w/x set maps memory itself instead of pointing to the next level
+bool pte_common_is_leaf(volatile pte_64model *pte)
+{
+    return pte -> v && (pte -> r || pte -> w || pte -> x);
+}
+
 //Must be executed in machine mode
 void pte_entry_sv39()
 {
@@ -78,6 +84,41 @@ void pte_refresh_tlb()
     asm volatile("sfence.vm");
 }
 
+//Only the translations of one virtual address
+void pte_refresh_tlb_addr(ulong addr)
+{
+    asm volatile("sfence.vm %0" :: "r"(addr) : "memory");
+}
+
+//Number of ASID bits in sptbr,0 if the field is hardwired to zero
+ulong pte_asid_bits()
+{
+    csr_define_common old = csr_read(csr_sptbr);
+    csr_define_common csr = old;
+    ulong bits = 0;
+
+    csr.sptbr.asid = (1UL << SPTBR_ASID_BITS) - 1;
+    csr_write(csr_sptbr,csr);
+    csr = csr_read(csr_sptbr);
+    csr_write(csr_sptbr,old);
+
+    while((bits < SPTBR_ASID_BITS) && (csr.sptbr.asid & (1UL << bits)))
+    {
+        bits++;
+    }
+
+    return bits;
+}
+
+//Switch root table and ASID without a flush,translations of other ASIDs stay valid
+void pte_set_root_page_table_asid(volatile pte_64model *pte,ulong asid)
+{
+    csr_define_common csr = csr_read(csr_sptbr);
+    csr.sptbr.ppn = ((ulong)pte) >> PTE_ADDR_OFFSET_LENGTH;
+    csr.sptbr.asid = asid;
+    csr_write(csr_sptbr,csr);
+}
+
 //pte must be aligned to 4-byte
 void pte_set_root_page_table(volatile pte_64model *pte)
 {
@@ -7,6 +7,8 @@
 #include "stddef.h"
 #include "stdarg.h"
 #include "linux/fs.h"
+#include "linux/config.h"
+#include "linux/mm.h"
 #include <fcntl.h>
 
 static char printbuf[1024];
@@ -196,6 +198,15 @@ void init()
     usersyscall_exit(0);
 }
 
+//the idle task of core 1,see user_main()
+void core1_idle_main()
+{
+    while(1)
+    {
+        usersyscall_pause();
+    }
+}
+
 void user_main()
 {   
     if(!usersyscall_fork())
@@ -275,7 +286,7 @@ int machine_main()
         pte_common_enable_entry((volatile pte_64model *)&page_dir_table[i]);
     }*/
 
-    pte_common_addr_to_ppn(&page_root_table[3],page_dir_table);
+    pte_common_addr_to_ppn(&page_root_table[3],cur_page_dir_table);
     pte_common_enable_user(&page_root_table[3]);
 
     pte_set_root_page_table((volatile pte_64model *)page_root_table);
@@ -327,6 +338,11 @@ int machine_main()
     rd_init(0x8007D000UL,0x5A000UL);
     syslog_print("rd_init ok\r\n");
     mem_init(0x80100000UL,0x80600000UL);
+    #ifdef CONFIG_AI_SRAM_ZONE
+        //the AI SRAM is only accessible with the KPU clock on
+        sysctl_clock_enable(SYSCTL_CLOCK_AI);
+        mem_add_zone(ZONE_AI,AI_RAM_BASE_ADDR,AI_RAM_BASE_ADDR + AI_RAM_SIZE);
+    #endif
     syslog_print("mem_init ok\r\n");
     blk_dev_init();
     syslog_print("blk_dev_init ok\r\n");
@@ -340,6 +356,8 @@ int machine_main()
     syslog_print("sched_init ok\r\n");
     buffer_init(&_buffer_end);
     syslog_print("buffer_init ok\r\n");
+    smp_init(core1_idle_main);
+    syslog_print("smp_init ok\r\n");
 
     /*page_dir_table = get_free_page();
     pte_common_addr_to_ppn((volatile pte_64model *)&page_root_table[3],(ulong)page_dir_table);
@@ -348,8 +366,7 @@ int machine_main()
     pte_refresh_tlb();*/
 
     sysctl_enable_irq();
-    
-    privilege_to_user(user_main);
+    smp_enter_user(user_main);
 
     /*while(1)
     {
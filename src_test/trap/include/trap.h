@@ -40,6 +40,12 @@
         uint32_t int_num;
         uint32_t int_threshold;
     }trap_info_t;
+
+    extern trap_info_t core_trap_info[];
+    extern bool core_trap_from_interrupt[];
+    //every hart keeps the trap it is handling
+    #define trap_info (core_trap_info[current_coreid()])
+    #define trap_from_interrupt (core_trap_from_interrupt[current_coreid()])
     
     typedef ulong trap_interrupt_multitype;
     typedef ulong trap_exception_multitype;
@@ -1,14 +1,13 @@
 #include "common.h"
 #include "linux/mm.h"
 #include "linux/kernel.h"
+#include "linux/sched.h"
 
-extern int64_t system_call(ulong a0,ulong a1,ulong a2,ulong a3);
+extern int64_t system_call(ulong a0,ulong a1,ulong a2,ulong a3,ulong a4,ulong a5,ulong a6);
 void do_wp_page(ulong address);
-void do_no_page(ulong address);
+void do_no_page(ulong address,bool write);
 //void machine_exception_handler_exit(ulong retvalue);
 void interrupt_recover();
-extern trap_info_t trap_info;
-extern bool trap_from_interrupt;
 extern int machine_main();
 extern void entry(int core_id);
 
@@ -36,7 +35,7 @@ ulong GetPageDirSum()
 {
     ulong sum = 0;
 
-    if(page_dir_table == NULL)
+    if(cur_page_dir_table == NULL)
     {
         syslog_print("page dir table is null!\r\n");
         while(1);
@@ -44,7 +43,7 @@ ulong GetPageDirSum()
 
     for(ulong i = 0;i < PAGE_SIZE;i += sizeof(xorsum))
     {
-        sum += *((ulong *)(((ulong)page_dir_table) + i));
+        sum += *((ulong *)(((ulong)cur_page_dir_table) + i));
     }
 
     return sum;
@@ -52,7 +51,7 @@ ulong GetPageDirSum()
 
 void PrintPageDir()
 {
-    syslog_dump_memory(page_dir_table,2048);   
+    syslog_dump_memory(cur_page_dir_table,2048);   
     syslog_dump_memory(page_dir_bak,2048);
 }
 
@@ -77,7 +76,7 @@ void CheckXorSum()
 void UpdateXorSum()
 {
     xorsum = GetPageDirSum();
-    memcpy(page_dir_bak,page_dir_table,4096);
+    memcpy(page_dir_bak,cur_page_dir_table,4096);
 }
 
 void machine_exception_store_or_amo_access_fault(ulong addr)
@@ -88,22 +87,26 @@ void machine_exception_store_or_amo_access_fault(ulong addr)
     {
         nopage = true;
     }
-    else if(page_dir_table == NULL)
+    else if(cur_page_dir_table == NULL)
     {
         nopage = true;
     }
-    else if(!page_dir_table[GET_PAGE_DIR_ID(addr)].v)
+    else if(!cur_page_dir_table[GET_PAGE_DIR_ID(addr)].v)
     {
         nopage = true;
     }
-    else if(!((volatile pte_sv39 *)pte_common_ppn_to_addr((volatile pte_64model *)&page_dir_table[GET_PAGE_DIR_ID(addr)]))[GET_PAGE_ENTRY_ID(addr)].v)
+    else if(pte_common_is_leaf((volatile pte_64model *)&cur_page_dir_table[GET_PAGE_DIR_ID(addr)]))
+    {
+        nopage = false;
+    }
+    else if(!((volatile pte_sv39 *)pte_common_ppn_to_addr((volatile pte_64model *)&cur_page_dir_table[GET_PAGE_DIR_ID(addr)]))[GET_PAGE_ENTRY_ID(addr)].v)
     {
         nopage = true;
     }
 
     if(nopage)
     {
-        do_no_page(addr);
+        do_no_page(addr,true);
     }
     else
     {
@@ -117,6 +120,13 @@ uintptr_t machine_exception_handler(trap_exception cause,uintptr_t epc,uintptr_t
     csr_define_common *mie = (csr_define_common *)(&csregs[1]);
     trap_info_t old_trap_info = trap_info;
     bool old_trap_from_interrupt = trap_from_interrupt;
+    bool from_user = (mstatus -> mstatus.mpp == privilege_level_user);
+
+    //the kernel is entered from user mode under the kernel lock,traps in the kernel have it already
+    if(from_user)
+    {
+        lock_kernel();
+    }
 
     trap_from_interrupt = false;
     trap_info.regs = regs;
@@ -198,7 +208,7 @@ uintptr_t machine_exception_handler(trap_exception cause,uintptr_t epc,uintptr_t
         case trap_exception_instruction_access_fault:
             trap_info.newepc = epc;
             //CheckXorSum();
-            do_no_page(csr_read(csr_mbadaddr).mbadaddr.value);
+            do_no_page(csr_read(csr_mbadaddr).mbadaddr.value,false);
             //UpdateXorSum();
             break;
 
@@ -214,7 +224,7 @@ uintptr_t machine_exception_handler(trap_exception cause,uintptr_t epc,uintptr_t
         case trap_exception_load_access_fault:
             trap_info.newepc = epc;
             //CheckXorSum();
-            do_no_page(csr_read(csr_mbadaddr).mbadaddr.value);
+            do_no_page(csr_read(csr_mbadaddr).mbadaddr.value,false);
             //UpdateXorSum();
             break;
 
@@ -256,7 +266,7 @@ uintptr_t machine_exception_handler(trap_exception cause,uintptr_t epc,uintptr_t
             }*/
             
             sysctl_enable_irq();
-            regs[reg_a0] = system_call(regs[reg_a7],regs[reg_a0],regs[reg_a1],regs[reg_a2]);
+            regs[reg_a0] = system_call(regs[reg_a7],regs[reg_a0],regs[reg_a1],regs[reg_a2],regs[reg_a3],regs[reg_a4],regs[reg_a5]);
 
             if(regs[reg_a7] == 1)
             {
@@ -314,6 +324,12 @@ uintptr_t machine_exception_handler(trap_exception cause,uintptr_t epc,uintptr_t
         }*/
 
         //printk("leave exception,cpl = %d\r\n",privilege_get_previous_level());
+
+        if(from_user)
+        {
+            unlock_kernel();
+        }
+
         return r;
     }
 
@@ -1,9 +1,6 @@
 #include "common.h"
 #include "linux/sched.h"
 
-extern trap_info_t trap_info;
-extern bool trap_from_interrupt;
-
 extern uintptr_t handle_irq_m_ext(uintptr_t cause,uintptr_t epc);
 extern int timer_interrupt(void *ctx);
 extern int machine_main();
@@ -15,14 +12,28 @@ uintptr_t machine_interrupt_handler(trap_interrupt cause,uintptr_t epc,uintptr_t
     csr_define_common *mie = (csr_define_common *)(&csregs[1]);
     trap_info_t old_trap_info = trap_info;
     bool old_trap_from_interrupt = trap_from_interrupt;
+    bool from_user = (mstatus -> mstatus.mpp == privilege_level_user);
 
     syslog_info("machine_interrupt_handler","cause = %d,epc = %p",cause,epc);
+
+    //the other core may be waiting for a TLB flush while it holds the kernel lock
+    if(cause == trap_interrupt_machine_software)
+    {
+        smp_ipi_interrupt();
+    }
+
+    if(from_user)
+    {
+        lock_kernel();
+    }
+
     //printk("entry interrupt\r\n");
     trap_from_interrupt = true;
     trap_info.regs = regs;
     trap_info.fregs = fregs;
     trap_info.epc = epc;
     trap_info.newepc = epc;
+    trap_info.int_num = 0;
 
 	switch(cause)
     {
@@ -30,6 +41,28 @@ uintptr_t machine_interrupt_handler(trap_interrupt cause,uintptr_t epc,uintptr_t
             handle_irq_m_ext((uintptr_t)cause,epc);
             //timer_interrupt(NULL);
             break;
+
+        case trap_interrupt_machine_timer:
+            //the CLINT timer of core 0 runs the high resolution timers,that of core 1 its tick
+            if(current_coreid() == 0)
+            {
+                hrtimer_interrupt();
+            }
+            else
+            {
+                smp_timer_interrupt();
+            }
+
+            break;
+
+        case trap_interrupt_machine_software:
+            //a task may have been queued for this core
+            if(from_user && is_idle_task(current))
+            {
+                schedule();
+            }
+
+            break;
     }
     
     syslog_info("machine_interrupt_handler","newepc = %p",trap_info.newepc);
@@ -64,6 +97,12 @@ uintptr_t machine_interrupt_handler(trap_interrupt cause,uintptr_t epc,uintptr_t
     }*/
     
     //printk("leave interrupt,cpl = %d\r\n",privilege_get_previous_level());
+
+    if(from_user)
+    {
+        unlock_kernel();
+    }
+
     return r;
 }
 
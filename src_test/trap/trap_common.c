@@ -2,8 +2,8 @@
 #include "linux/mm.h"
 #include "linux/sched.h"
 
-trap_info_t trap_info;
-bool trap_from_interrupt;
+trap_info_t core_trap_info[CORE_NUM];
+bool core_trap_from_interrupt[CORE_NUM];
 const char *reg_str[] = {"zero","ra","sp","gp","tp","t0","t1","t2","fp","s0","s1","a0","a1","a2","a3","a4","a5","a6","a7","s2","s3","s4","s5","s6","s7","s8","s9","s10","s11","t3","t4","t5","t6"};
 
 trap_interrupt_multitype trap_interrupt_generate_multitype(ulong num,...)
@@ -53,11 +53,11 @@ void trap_listregs()
     }
 }
 
-extern ulong cur_kernel_stack;
+extern ulong cur_kernel_stack[];
 
 void trap_listuserstack()
 {
-    printk("current kernel stack = %p\r\n",cur_kernel_stack);
+    printk("current kernel stack = %p\r\n",cur_kernel_stack[current_coreid()]);
     printk("userstack:sp = %p\r\n",trap_info.regs[reg_sp]);
     ulong sp = trap_info.regs[reg_sp];
 
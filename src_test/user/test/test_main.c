@@ -55,6 +55,10 @@ typedef long ssize_t;
 #include <fcntl.h>
 #include <termios.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <signal.h>
+#include <errno.h>
 
 static char buf[1024];
 
@@ -73,8 +77,24 @@ static inline _syscall3(int64_t,open,const char *,filename,int,flag,int,mode);
 static inline _syscall1(int64_t,close,int,fd);
 static inline _syscall2(int64_t,stat,const char *,filename,struct stat *,stat_buf);
 static inline _syscall0(int64_t,fork);
+static inline _syscall0(int64_t,vfork);
 static inline _syscall3(int64_t,waitpid,pid_t,pid,uint *,stat_addr,int,options);
 static inline _syscall3(int64_t,execve,const char *,file,char **,argv,char **,envp);
+static inline _syscall1(int64_t,debug,ulong,p);
+static inline _syscall6(int64_t,mmap,void *,addr,ulong,len,int,prot,int,flags,int,fd,ulong,offset);
+static inline _syscall2(int64_t,munmap,void *,addr,ulong,len);
+static inline _syscall1(int64_t,mlockall,int,flags);
+static inline _syscall0(int64_t,munlockall);
+static inline _syscall3(int64_t,madvise,void *,addr,ulong,len,int,advice);
+static inline _syscall4(int64_t,fadvise64,int,fd,ulong,offset,ulong,len,int,advice);
+static inline _syscall1(int64_t,times,void *,tbuf);
+static inline _syscall1(int64_t,alarm,long,seconds);
+static inline _syscall0(int64_t,pause);
+static inline _syscall3(int64_t,signal,int,signum,long,handler,long,restorer);
+static inline _syscall2(int64_t,nanosleep,const struct timespec *,req,struct timespec *,rem);
+static inline _syscall2(int64_t,getitimer,int,which,struct itimerval *,value);
+static inline _syscall3(int64_t,setitimer,int,which,const struct itimerval *,value,struct itimerval *,ovalue);
+static inline _syscall1(int64_t,pipe,ulong *,fildes);
 
 int main(int argc,char **argv,char **envp);
 
@@ -161,12 +181,1056 @@ void dump_memory(void *mem,ulong length)
 
 char buf2[100];
 
+extern void *sbrk(long increment);
+
+static inline ulong rdcycle()
+{
+    ulong v;
+    asm volatile("rdcycle %0" : "=r"(v));
+    return v;
+}
+
+//Reports a failed check of a bench,returns ok
+static int bench_check(const char *bench,int ok,const char *what)
+{
+    if(!ok)
+    {
+        printf("bench %s:FAILED,%s\r\n",bench,what);
+    }
+
+    return ok;
+}
+
+#define BENCH_SWAP_PAGES 64
+
+//Fills heap pages with patterns,moves them into the compressed swap pool and checks that they read back unchanged
+static void bench_swap()
+{
+    pid_t pid;
+    int stat;
+
+    if(!(pid = usersyscall_fork()))
+    {
+        ulong *start;
+        ulong i,j,out,fault;
+        int ok;
+
+        usersyscall_debug(DEBUG_MEGAPAGE_OFF);
+
+        if((start = sbrk(BENCH_SWAP_PAGES * 4096)) == (void *)-1)
+        {
+            printf("bench swap:sbrk failed\r\n");
+            usersyscall_exit(1);
+        }
+
+        //even pages repeat one word,odd pages have runs that compress
+        for(i = 0;i < BENCH_SWAP_PAGES;i++)
+        {
+            for(j = 0;j < 512;j++)
+            {
+                start[i * 512 + j] = (i & 1) ? ((i << 32) | (j >> 4)) : (i * 0x0101010101010101UL);
+            }
+        }
+
+        out = usersyscall_debug(DEBUG_SWAP_OUT);
+        ok = bench_check("swap",out >= BENCH_SWAP_PAGES,"pages stayed resident");
+        fault = rdcycle();
+
+        for(i = 0;i < BENCH_SWAP_PAGES;i++)
+        {
+            for(j = 0;j < 512;j++)
+            {
+                if(start[i * 512 + j] != ((i & 1) ? ((i << 32) | (j >> 4)) : (i * 0x0101010101010101UL)))
+                {
+                    break;
+                }
+            }
+
+            if(!bench_check("swap",j == 512,"contents changed"))
+            {
+                ok = 0;
+                break;
+            }
+        }
+
+        fault = rdcycle() - fault;
+        printf("bench swap:%lu pages out,read back %lu cycles(avg of %d),%s\r\n",out,fault / BENCH_SWAP_PAGES,BENCH_SWAP_PAGES,ok ? "passed" : "failed");
+        usersyscall_debug(DEBUG_SHOW_SWAP);
+        usersyscall_exit(!ok);
+    }
+
+    while(pid != wait(&stat));
+    usersyscall_debug(DEBUG_MEGAPAGE_ON);
+}
+
+#define BENCH_TLB_SIZE (2UL * 1024UL * 1024UL)
+#define BENCH_TLB_ROUNDS 16
+
+//Grows the heap by a 2MB aligned block and strides over it a page at a time,
+//in a child so that every run starts with an unmapped block
+static void bench_tlb(int megapage)
+{
+    pid_t pid;
+    int stat;
+
+    if(!(pid = usersyscall_fork()))
+    {
+        char *base,*start;
+        ulong fault,walk,off,sum = 0;
+        pid_t child;
+        long fd;
+        int r;
+
+        usersyscall_debug(megapage ? DEBUG_MEGAPAGE_ON : DEBUG_MEGAPAGE_OFF);
+        base = sbrk(0);
+        start = (char *)((((ulong)base) + BENCH_TLB_SIZE - 1) & ~(BENCH_TLB_SIZE - 1));
+
+        if(sbrk(start + BENCH_TLB_SIZE - base) == (void *)-1)
+        {
+            printf("bench tlb:sbrk failed\r\n");
+            usersyscall_exit(1);
+        }
+
+        fault = rdcycle();
+
+        for(off = 0;off < BENCH_TLB_SIZE;off += 4096)
+        {
+            start[off] = 1;
+        }
+
+        fault = rdcycle() - fault;
+        walk = rdcycle();
+
+        for(r = 0;r < BENCH_TLB_ROUNDS;r++)
+        {
+            for(off = 0;off < BENCH_TLB_SIZE;off += 4096)
+            {
+                sum += start[off];
+            }
+        }
+
+        walk = rdcycle() - walk;
+        printf("bench tlb:megapage %s,first touch %lu cycles,%d strided rounds %lu cycles(%lu)\r\n",megapage ? "on" : "off",fault,BENCH_TLB_ROUNDS,walk,sum);
+
+        //fork shares the block copy-on-write,so neither the child nor the kernel writing for it may change our copy
+        if(!(child = usersyscall_fork()))
+        {
+            if((fd = usersyscall_open("/bin/sh",O_RDONLY,0)) >= 0)
+            {
+                usersyscall_read(fd,start,4096);
+                usersyscall_close(fd);
+            }
+
+            for(off = 4096;off < BENCH_TLB_SIZE;off += 4096)
+            {
+                start[off] = 2;
+            }
+
+            usersyscall_exit(0);
+        }
+
+        while(child != wait(&stat));
+
+        for(off = 0;off < BENCH_TLB_SIZE;off += 4096)
+        {
+            if(start[off] != 1)
+            {
+                break;
+            }
+        }
+
+        usersyscall_exit(!bench_check("tlb",off == BENCH_TLB_SIZE,"copy-on-write leaked a write of the child"));
+    }
+
+    while(pid != wait(&stat));
+    usersyscall_debug(DEBUG_MEGAPAGE_ON);
+}
+
+#define BENCH_FORK_SIZE (4UL * 1024UL * 1024UL)
+#define BENCH_FORK_ROUNDS 16
+
+//Touches a 4MB heap in 4KB pages,then times fork() in the parent while every child exits at once
+static void bench_fork(int share)
+{
+    pid_t pid;
+    int stat;
+
+    if(!(pid = usersyscall_fork()))
+    {
+        char *base;
+        ulong off,start,forked = 0,total = 0;
+        pid_t child;
+        int r;
+
+        usersyscall_debug(DEBUG_MEGAPAGE_OFF);
+        usersyscall_debug(share ? DEBUG_PGTABLE_SHARE_ON : DEBUG_PGTABLE_SHARE_OFF);
+
+        if((base = sbrk(BENCH_FORK_SIZE)) == (void *)-1)
+        {
+            printf("bench fork:sbrk failed\r\n");
+            usersyscall_exit(1);
+        }
+
+        for(off = 0;off < BENCH_FORK_SIZE;off += 4096)
+        {
+            base[off] = 1;
+        }
+
+        for(r = 0;r < BENCH_FORK_ROUNDS;r++)
+        {
+            start = rdcycle();
+
+            if(!(child = usersyscall_fork()))
+            {
+                usersyscall_exit(0);
+            }
+
+            forked += rdcycle() - start;
+            while(child != wait(&stat));
+            total += rdcycle() - start;
+        }
+
+        printf("bench fork:page table sharing %s,fork %lu cycles,fork+exit+wait %lu cycles(avg of %d)\r\n",share ? "on" : "off",forked / BENCH_FORK_ROUNDS,total / BENCH_FORK_ROUNDS,BENCH_FORK_ROUNDS);
+
+        //the first write of a child copies the shared table,its writes must land in its copy only
+        if(!(child = usersyscall_fork()))
+        {
+            for(off = 0;off < BENCH_FORK_SIZE;off += 4096)
+            {
+                base[off] = 2;
+            }
+
+            for(off = 0;off < BENCH_FORK_SIZE;off += 4096)
+            {
+                if(base[off] != 2)
+                {
+                    break;
+                }
+            }
+
+            usersyscall_exit(!bench_check("fork",off == BENCH_FORK_SIZE,"a write of the child got lost"));
+        }
+
+        while(child != wait(&stat));
+
+        for(off = 0;off < BENCH_FORK_SIZE;off += 4096)
+        {
+            if(base[off] != 1)
+            {
+                break;
+            }
+        }
+
+        usersyscall_exit(!bench_check("fork",off == BENCH_FORK_SIZE,"copy-on-write leaked a write of the child"));
+    }
+
+    while(pid != wait(&stat));
+    usersyscall_debug(DEBUG_MEGAPAGE_ON);
+    usersyscall_debug(DEBUG_PGTABLE_SHARE_ON);
+}
+
+#define BENCH_FAULT_SIZE (1024UL * 1024UL)
+#define BENCH_FAULT_PAGES (BENCH_FAULT_SIZE / 4096)
+
+//Average cycles of a first write fault,of a fork() over the written heap and of a copy-on-write fault in the child,
+//all in 4KB pages.Each of them changes page table entries,so they show what TLB flushing costs.
+//A stale TLB entry shows up as a write that lands in the wrong copy
+static void bench_fault()
+{
+    pid_t pid;
+    int stat;
+
+    if(!(pid = usersyscall_fork()))
+    {
+        char *base;
+        ulong off,fault,forked,cow;
+        ulong fd[2] = {0,0};
+        pid_t child;
+        char c;
+
+        usersyscall_debug(DEBUG_MEGAPAGE_OFF);
+
+        if((base = sbrk(BENCH_FAULT_SIZE)) == (void *)-1)
+        {
+            printf("bench fault:sbrk failed\r\n");
+            usersyscall_exit(1);
+        }
+
+        fault = rdcycle();
+
+        for(off = 0;off < BENCH_FAULT_SIZE;off += 4096)
+        {
+            base[off] = 1;
+        }
+
+        fault = rdcycle() - fault;
+        forked = rdcycle();
+
+        if(!(child = usersyscall_fork()))
+        {
+            cow = rdcycle();
+
+            for(off = 0;off < BENCH_FAULT_SIZE;off += 4096)
+            {
+                base[off] = 2;
+            }
+
+            cow = rdcycle() - cow;
+            printf("bench fault:cow fault %lu cycles(avg of %lu)\r\n",cow / BENCH_FAULT_PAGES,BENCH_FAULT_PAGES);
+
+            for(off = 0;off < BENCH_FAULT_SIZE;off += 4096)
+            {
+                if(base[off] != 2)
+                {
+                    break;
+                }
+            }
+
+            usersyscall_exit(!bench_check("fault",off == BENCH_FAULT_SIZE,"the child read the old page after its copy-on-write fault"));
+        }
+
+        forked = rdcycle() - forked;
+        while(child != wait(&stat));
+        printf("bench fault:write fault %lu cycles(avg of %lu),fork %lu cycles\r\n",fault / BENCH_FAULT_PAGES,BENCH_FAULT_PAGES,forked);
+        usersyscall_debug(DEBUG_SHOW_MEM);
+
+        //writing the heap makes it writable and loads it into the TLB,then fork() write-protects it again.
+        //A writable TLB entry left from before would let the writes below reach the child
+        for(off = 0;off < BENCH_FAULT_SIZE;off += 4096)
+        {
+            base[off] = 1;
+        }
+
+        if(!bench_check("fault",usersyscall_pipe(fd) == 0,"pipe() failed"))
+        {
+            usersyscall_exit(1);
+        }
+
+        if(!(child = usersyscall_fork()))
+        {
+            usersyscall_read(fd[0],&c,1);
+
+            for(off = 0;off < BENCH_FAULT_SIZE;off += 4096)
+            {
+                if(base[off] != 1)
+                {
+                    break;
+                }
+            }
+
+            usersyscall_exit(!bench_check("fault",off == BENCH_FAULT_SIZE,"a write of the parent after fork() reached the child"));
+        }
+
+        for(off = 0;off < BENCH_FAULT_SIZE;off += 4096)
+        {
+            base[off] = 3;
+        }
+
+        usersyscall_write(fd[1],"x",1);
+        while(child != wait(&stat));
+        usersyscall_close(fd[0]);
+        usersyscall_close(fd[1]);
+        usersyscall_exit(0);
+    }
+
+    while(pid != wait(&stat));
+    usersyscall_debug(DEBUG_MEGAPAGE_ON);
+}
+
+#define BENCH_ASID_TASKS 4
+#define BENCH_ASID_PAGES 64
+#define BENCH_ASID_ROUNDS 32
+
+//Tasks with their own data at the same heap addresses sleep in turn,so every round switches between their address spaces.
+//An entry cached for another task shows up as a word that isn't ours
+static void bench_asid()
+{
+    pid_t pid[BENCH_ASID_TASKS];
+    int stat,i;
+
+    for(i = 0;i < BENCH_ASID_TASKS;i++)
+    {
+        if(!(pid[i] = usersyscall_fork()))
+        {
+            struct timespec t = {0,1000000L};
+            ulong *start,off,start_cycle;
+            ulong v = (i + 1) * 0x0101010101010101UL;
+            int r;
+
+            if((start = sbrk(BENCH_ASID_PAGES * 4096)) == (void *)-1)
+            {
+                printf("bench asid:sbrk failed\r\n");
+                usersyscall_exit(1);
+            }
+
+            for(off = 0;off < BENCH_ASID_PAGES * 512;off += 512)
+            {
+                start[off] = v;
+            }
+
+            start_cycle = rdcycle();
+
+            for(r = 0;r < BENCH_ASID_ROUNDS;r++)
+            {
+                usersyscall_nanosleep(&t,NULL);
+
+                for(off = 0;off < BENCH_ASID_PAGES * 512;off += 512)
+                {
+                    if(start[off] != v)
+                    {
+                        break;
+                    }
+                }
+
+                if(!bench_check("asid",off == BENCH_ASID_PAGES * 512,"a task read the page of another task after a switch"))
+                {
+                    usersyscall_exit(1);
+                }
+            }
+
+            printf("bench asid:task %d,%lu cycles per round(avg of %d)\r\n",i,(rdcycle() - start_cycle) / BENCH_ASID_ROUNDS,BENCH_ASID_ROUNDS);
+            usersyscall_exit(0);
+        }
+    }
+
+    for(i = 0;i < BENCH_ASID_TASKS;i++)
+    {
+        usersyscall_waitpid(pid[i],(uint *)&stat,0);
+    }
+
+    usersyscall_debug(DEBUG_SHOW_MEM);
+}
+
+#define BENCH_SPAWN_ROUNDS 16
+
+static char *bench_spawn_argv[] = {"/bin/sh","-exit",NULL};
+static char *bench_spawn_envp[] = {NULL};
+
+//Runs "/bin/sh -exit" from a process with a touched 4MB heap,spawned by fork() or vfork()
+static void bench_spawn(int use_vfork)
+{
+    pid_t pid;
+    int stat;
+
+    if(!(pid = usersyscall_fork()))
+    {
+        char *base;
+        ulong off,start,total = 0;
+        pid_t child;
+        int r,failed = 0;
+
+        usersyscall_debug(DEBUG_MEGAPAGE_OFF);
+
+        if((base = sbrk(BENCH_FORK_SIZE)) == (void *)-1)
+        {
+            printf("bench spawn:sbrk failed\r\n");
+            usersyscall_exit(1);
+        }
+
+        for(off = 0;off < BENCH_FORK_SIZE;off += 4096)
+        {
+            base[off] = 1;
+        }
+
+        for(r = 0;r < BENCH_SPAWN_ROUNDS;r++)
+        {
+            start = rdcycle();
+
+            //the vfork() child runs on our stack,so it only calls execve() and exit()
+            if(!(child = use_vfork ? usersyscall_vfork() : usersyscall_fork()))
+            {
+                usersyscall_execve(bench_spawn_argv[0],bench_spawn_argv,bench_spawn_envp);
+                usersyscall_exit(127);
+            }
+
+            while(child != wait(&stat));
+            total += rdcycle() - start;
+            failed |= (stat != 0);
+        }
+
+        printf("bench spawn:%s+exec+exit+wait %lu cycles(avg of %d)\r\n",use_vfork ? "vfork" : "fork",total / BENCH_SPAWN_ROUNDS,BENCH_SPAWN_ROUNDS);
+
+        //the heap must come through a vfork() child that borrowed it untouched
+        for(off = 0;off < BENCH_FORK_SIZE;off += 4096)
+        {
+            if(base[off] != 1)
+            {
+                break;
+            }
+        }
+
+        failed = !bench_check("spawn",!failed,"a child didn't exec and exit with 0");
+        failed |= !bench_check("spawn",off == BENCH_FORK_SIZE,"the heap changed across the spawns");
+        usersyscall_exit(failed);
+    }
+
+    while(pid != wait(&stat));
+    usersyscall_debug(DEBUG_MEGAPAGE_ON);
+}
+
+//Sums a file once through read() and once through a read-only mapping
+static void bench_mmap(const char *path)
+{
+    struct stat s;
+    ulong start,t_read,t_mmap,sum_read = 0,sum_mmap = 0,i;
+    long fd,size;
+    uint8_t *map;
+
+    if((usersyscall_stat(path,&s) < 0) || ((fd = usersyscall_open(path,O_RDONLY,0)) < 0))
+    {
+        printf("bench mmap:can't open %s\r\n",path);
+        return;
+    }
+
+    start = rdcycle();
+
+    while((size = usersyscall_read(fd,buf,sizeof(buf))) > 0)
+    {
+        for(i = 0;i < size;i++)
+        {
+            sum_read += (uint8_t)buf[i];
+        }
+    }
+
+    t_read = rdcycle() - start;
+    start = rdcycle();
+
+    if((map = (uint8_t *)usersyscall_mmap(NULL,s.st_size,PROT_READ,MAP_PRIVATE,fd,0)) == MAP_FAILED)
+    {
+        printf("bench mmap:mmap failed,errno = %d\r\n",errno);
+        usersyscall_close(fd);
+        return;
+    }
+
+    for(i = 0;i < s.st_size;i++)
+    {
+        sum_mmap += map[i];
+    }
+
+    t_mmap = rdcycle() - start;
+    usersyscall_munmap(map,s.st_size);
+    usersyscall_close(fd);
+    printf("bench mmap:%s %ld bytes,read() %lu cycles,mmap() %lu cycles,sums %s\r\n",path,(long)s.st_size,t_read,t_mmap,(sum_read == sum_mmap) ? "match" : "differ");
+    bench_check("mmap",sum_read == sum_mmap,"the mapping differs from read()");
+}
+
+#define BENCH_ZERO_SIZE (2UL * 1024UL * 1024UL)
+#define BENCH_ZERO_CHECK_SIZE (64UL * 1024UL)
+
+//Reads a fresh 2MB heap block a page at a time,which maps the zero page only,then writes it
+static void bench_zero()
+{
+    pid_t pid;
+    int stat;
+
+    if(!(pid = usersyscall_fork()))
+    {
+        char *start = sbrk(BENCH_ZERO_SIZE);
+        ulong read,write,off,sum = 0;
+        int ok;
+
+        if(start == (void *)-1)
+        {
+            printf("bench zero:sbrk failed\r\n");
+            usersyscall_exit(1);
+        }
+
+        read = rdcycle();
+
+        for(off = 0;off < BENCH_ZERO_SIZE;off += 4096)
+        {
+            sum += start[off];
+        }
+
+        read = rdcycle() - read;
+        usersyscall_debug(DEBUG_SHOW_MEM);
+        write = rdcycle();
+
+        for(off = 0;off < BENCH_ZERO_SIZE;off += 4096)
+        {
+            start[off] = 1;
+        }
+
+        write = rdcycle() - write;
+        printf("bench zero:read faults %lu cycles,write faults %lu cycles(%lu)\r\n",read,write,sum);
+        ok = bench_check("zero",sum == 0,"fresh heap didn't read as zeroes");
+
+        for(off = 0;off < BENCH_ZERO_SIZE;off += 4096)
+        {
+            if((start[off] != 1) || (start[off + 1] != 0))
+            {
+                break;
+            }
+        }
+
+        ok &= bench_check("zero",off == BENCH_ZERO_SIZE,"a written page didn't keep the write and zeroes around it");
+
+        //a write that went into the shared zero page would show up in every fresh read
+        if((start = sbrk(BENCH_ZERO_CHECK_SIZE)) != (void *)-1)
+        {
+            for(off = 0;off < BENCH_ZERO_CHECK_SIZE;off += 4096)
+            {
+                if(start[off] != 0)
+                {
+                    break;
+                }
+            }
+
+            ok &= bench_check("zero",off == BENCH_ZERO_CHECK_SIZE,"the zero page was written");
+        }
+
+        usersyscall_exit(!ok);
+    }
+
+    while(pid != wait(&stat));
+}
+
+#define BENCH_MLOCK_SIZE (1024UL * 1024UL)
+
+//Grows the heap by 1MB after mlockall() or without it,and times the first write to each page.
+//A locked heap must stay out of swap and be faulted in already
+static void bench_mlock(int lock)
+{
+    pid_t pid;
+    int stat;
+
+    if(!(pid = usersyscall_fork()))
+    {
+        char *start;
+        ulong prefault = 0,touch,refault,off;
+        int ok;
+
+        usersyscall_debug(DEBUG_MEGAPAGE_OFF);
+        ok = bench_check("mlock",(usersyscall_mlockall(0) == -1) && (errno == EINVAL),"empty flags weren't EINVAL");
+
+        if(lock)
+        {
+            prefault = rdcycle();
+            ok &= bench_check("mlock",usersyscall_mlockall(MCL_CURRENT | MCL_FUTURE) == 0,"mlockall() failed");
+            prefault = rdcycle() - prefault;
+        }
+
+        if((start = sbrk(BENCH_MLOCK_SIZE)) == (void *)-1)
+        {
+            printf("bench mlock:sbrk failed\r\n");
+            usersyscall_exit(1);
+        }
+
+        touch = rdcycle();
+
+        for(off = 0;off < BENCH_MLOCK_SIZE;off += 4096)
+        {
+            start[off] = 1;
+        }
+
+        touch = rdcycle() - touch;
+        printf("bench mlock:mlockall %s,mlockall %lu cycles,first writes %lu cycles\r\n",lock ? "on" : "off",prefault,touch);
+
+        if(lock)
+        {
+            ok &= bench_check("mlock",usersyscall_debug(DEBUG_SWAP_OUT) == 0,"pages of a locked task were swapped");
+        }
+
+        //once unlocked the heap goes to swap,and writing it again faults every page back in
+        ok &= bench_check("mlock",usersyscall_munlockall() == 0,"munlockall() failed");
+        ok &= bench_check("mlock",usersyscall_debug(DEBUG_SWAP_OUT) >= BENCH_MLOCK_SIZE / 4096,"the heap stayed resident after munlockall()");
+        refault = rdcycle();
+
+        for(off = 0;off < BENCH_MLOCK_SIZE;off += 4096)
+        {
+            start[off] = 2;
+        }
+
+        refault = rdcycle() - refault;
+
+        if(lock)
+        {
+            ok &= bench_check("mlock",touch < refault,"the first writes faulted,mlockall() didn't prefault the heap");
+        }
+
+        usersyscall_exit(!ok);
+    }
+
+    while(pid != wait(&stat));
+    usersyscall_debug(DEBUG_MEGAPAGE_ON);
+}
+
+//Drops the cached blocks of a file,then times touching every page of a mapping of it under an madvise() hint,
+//the bytes touched must be the ones read() returns
+static void bench_madvise(const char *path,int advice)
+{
+    static const char *advice_name[] = {"normal","random","sequential"};
+    struct stat s;
+    ulong start,i,sum = 0,sum_read = 0,pos = 0;
+    long fd,size;
+    uint8_t *map;
+
+    if((usersyscall_stat(path,&s) < 0) || ((fd = usersyscall_open(path,O_RDONLY,0)) < 0))
+    {
+        printf("bench madvise:can't open %s\r\n",path);
+        return;
+    }
+
+    usersyscall_fadvise64(fd,0,0,POSIX_FADV_DONTNEED);
+
+    if((map = (uint8_t *)usersyscall_mmap(NULL,s.st_size,PROT_READ,MAP_PRIVATE,fd,0)) == MAP_FAILED)
+    {
+        printf("bench madvise:mmap failed,errno = %d\r\n",errno);
+        usersyscall_close(fd);
+        return;
+    }
+
+    bench_check("madvise",usersyscall_madvise(map,s.st_size,advice) == 0,"madvise() failed");
+    start = rdcycle();
+
+    for(i = 0;i < s.st_size;i += 4096)
+    {
+        sum += map[i];
+    }
+
+    start = rdcycle() - start;
+
+    while((size = usersyscall_read(fd,buf,sizeof(buf))) > 0)
+    {
+        for(i = 0;i < size;i++)
+        {
+            sum_read += (((pos + i) & 4095) == 0) ? (uint8_t)buf[i] : 0;
+        }
+
+        pos += size;
+    }
+
+    usersyscall_munmap(map,s.st_size);
+    usersyscall_close(fd);
+    printf("bench madvise:%s,%ld bytes touched in %lu cycles(%lu)\r\n",advice_name[advice],(long)s.st_size,start,sum);
+    bench_check("madvise",sum == sum_read,"the mapping differs from read()");
+}
+
+//Checks the argument errors of madvise(),and that MADV_DONTNEED drops the private copy of a file page
+static void bench_madvise_check(const char *path)
+{
+    uint8_t *map,first;
+    long fd;
+
+    if((fd = usersyscall_open(path,O_RDONLY,0)) < 0)
+    {
+        return;
+    }
+
+    if((map = (uint8_t *)usersyscall_mmap(NULL,4096,PROT_READ | PROT_WRITE,MAP_PRIVATE,fd,0)) == MAP_FAILED)
+    {
+        bench_check("madvise",0,"a private writable mapping failed");
+        usersyscall_close(fd);
+        return;
+    }
+
+    first = map[0];
+    map[0] = ~first;
+    bench_check("madvise",(usersyscall_madvise(map + 1,4096,MADV_NORMAL) == -1) && (errno == EINVAL),"an unaligned address wasn't EINVAL");
+    bench_check("madvise",(usersyscall_madvise(map,4096,MADV_DONTNEED + 1) == -1) && (errno == EINVAL),"an unknown advice wasn't EINVAL");
+    bench_check("madvise",usersyscall_madvise(map,4096,MADV_DONTNEED) == 0,"MADV_DONTNEED failed");
+    bench_check("madvise",map[0] == first,"MADV_DONTNEED kept the private copy");
+    usersyscall_munmap(map,4096);
+    bench_check("madvise",(usersyscall_madvise(map,4096,MADV_NORMAL) == -1) && (errno == ENOMEM),"an unmapped range wasn't ENOMEM");
+    usersyscall_close(fd);
+}
+
+#define BENCH_SCHED_SPIN (20UL * 1000UL * 1000UL)//cycles each child stays runnable
+#define BENCH_SCHED_USED 4//task 0,init,the shell and the bench itself
+
+//Fills the task table up to ntasks with children that spin on the cycle counter,
+//then prints what schedule() cost while they shared the cpu
+static void bench_sched(int ntasks)
+{
+    pid_t pid;
+    int stat;
+
+    if(!(pid = usersyscall_fork()))
+    {
+        pid_t child;
+        ulong start;
+        int n,i,done = 0;
+
+        usersyscall_debug(DEBUG_SCHED_RESET);
+
+        for(n = 0;n < ntasks - BENCH_SCHED_USED;n++)
+        {
+            if((child = usersyscall_fork()) < 0)
+            {
+                break;
+            }
+
+            if(!child)
+            {
+                start = rdcycle();
+                while(rdcycle() - start < BENCH_SCHED_SPIN);
+                usersyscall_exit(0);
+            }
+        }
+
+        //every spinning child must get the cpu and finish
+        for(i = 0;i < n;i++)
+        {
+            done += (wait(&stat) > 0) && (stat == 0);
+        }
+
+        printf("bench sched:%d tasks,%d spinning\r\n",n + BENCH_SCHED_USED,n);
+        usersyscall_debug(DEBUG_SHOW_SCHED);
+        usersyscall_exit(!bench_check("sched",done == n,"a spinning child didn't finish"));
+    }
+
+    while(pid != wait(&stat));
+}
+
+#define BENCH_SMP_LOOPS (200UL * 1000UL * 1000UL)
+
+//Runs BENCH_SMP_LOOPS iterations split between n children,returns the jiffies it took
+static int64_t bench_smp_run(int n)
+{
+    volatile ulong sum = 0;
+    int64_t start = usersyscall_times(NULL);
+    ulong j;
+    int i,stat;
+
+    for(i = 0;i < n;i++)
+    {
+        if(!usersyscall_fork())
+        {
+            for(j = 0;j < BENCH_SMP_LOOPS / n;j++)
+            {
+                sum += j;
+            }
+
+            usersyscall_exit(0);
+        }
+    }
+
+    for(i = 0;i < n;i++)
+    {
+        wait(&stat);
+    }
+
+    return usersyscall_times(NULL) - start;
+}
+
+//The same work done by one child,then by two which can run on both cores at once
+static void bench_smp()
+{
+    int64_t one = bench_smp_run(1);
+    int64_t two = bench_smp_run(2);
+
+    printf("bench smp:1 task %ld jiffies,2 tasks %ld jiffies,speedup %ld%%\r\n",one,two,two ? one * 100 / two : 0);
+    //on one core the split work takes as long as the whole,with a second core it takes less
+    bench_check("smp",(one > 0) && (two <= one + one / 10 + 1),"two tasks took longer than one");
+    usersyscall_debug(DEBUG_SHOW_SMP);
+}
+
+#define BENCH_TICK_SECONDS 2
+#define BENCH_TICK_SPIN (200UL * 1000UL * 1000UL)
+#define BENCH_TICK_SLACK 10//jiffies the alarm may be late by
+
+//The tick interrupts taken while the system sleeps on an alarm,then while a single task spins.
+//jiffies have to catch up over the stopped tick,so the alarm must still take its seconds
+static void bench_tick()
+{
+    volatile ulong sum = 0;
+    int64_t jiffies;
+    ulong j;
+    int stat;
+
+    usersyscall_debug(DEBUG_SCHED_RESET);
+    jiffies = usersyscall_times(NULL);
+
+    //SIGALRM ends the child
+    if(!usersyscall_fork())
+    {
+        usersyscall_alarm(BENCH_TICK_SECONDS);
+        usersyscall_pause();
+        usersyscall_exit(0);
+    }
+
+    wait(&stat);
+    jiffies = usersyscall_times(NULL) - jiffies;
+    printf("bench tick:idle for %d seconds,%ld jiffies passed\r\n",BENCH_TICK_SECONDS,jiffies);
+    bench_check("tick",(jiffies >= BENCH_TICK_SECONDS * 100 - 1) && (jiffies <= BENCH_TICK_SECONDS * 100 + BENCH_TICK_SLACK),"the alarm was early or late");
+    usersyscall_debug(DEBUG_SHOW_SCHED);
+    usersyscall_debug(DEBUG_SCHED_RESET);
+
+    if(!usersyscall_fork())
+    {
+        for(j = 0;j < BENCH_TICK_SPIN;j++)
+        {
+            sum += j;
+        }
+
+        usersyscall_exit(0);
+    }
+
+    wait(&stat);
+    printf("bench tick:one task running\r\n");
+    usersyscall_debug(DEBUG_SHOW_SCHED);
+}
+
+#define BENCH_NANOSLEEP_ROUNDS 10
+#define BENCH_NANOSLEEP_TICKS 5//the sleep timed in jiffies
+#define BENCH_NANOSLEEP_SLACK 5//jiffies a sleep may overrun on an idle system
+
+//A one second sleep cut short by a one-shot interval timer,the child exits with 0 if nanosleep() failed with EINTR
+//and left the rest of the second in rem
+static void bench_nanosleep_rem()
+{
+    struct timespec t,rem;
+    struct itimerval it;
+    pid_t pid;
+    int stat = 0;
+
+    if(!(pid = usersyscall_fork()))
+    {
+        //ignored,it still ends the sleep
+        usersyscall_signal(SIGALRM,(long)SIG_IGN,0);
+        memset(&it,0,sizeof(it));
+        it.it_value.tv_usec = 20000;
+        usersyscall_setitimer(ITIMER_REAL,&it,NULL);
+        t.tv_sec = 1;
+        t.tv_nsec = 0;
+        rem.tv_sec = -1;
+        rem.tv_nsec = -1;
+
+        if((usersyscall_nanosleep(&t,&rem) != -1) || (errno != EINTR))
+        {
+            usersyscall_exit(1);
+        }
+
+        usersyscall_exit(((rem.tv_sec == 0) && (rem.tv_nsec > 500000000L) && (rem.tv_nsec < 1000000000L)) ? 0 : 2);
+    }
+
+    while(pid != wait(&stat));
+    bench_check("nanosleep",stat == 0,"an interrupted sleep didn't return EINTR with the time left in rem");
+}
+
+//The cycles nanosleep() takes for sleeps shorter than,as long as and longer than a tick,
+//then checks the errors,the length of a sleep and an interval timer read back while it runs
+static void bench_nanosleep()
+{
+    static const long nsec[] = {100000L,1000000L,10000000L,25000000L};
+    struct timespec t;
+    struct itimerval it;
+    ulong start,total;
+    int64_t jiffies;
+    int i,j,failed = 0;
+
+    usersyscall_debug(DEBUG_SCHED_RESET);
+
+    for(i = 0;i < sizeof(nsec) / sizeof(nsec[0]);i++)
+    {
+        t.tv_sec = 0;
+        t.tv_nsec = nsec[i];
+        total = 0;
+
+        for(j = 0;j < BENCH_NANOSLEEP_ROUNDS;j++)
+        {
+            start = rdcycle();
+            failed |= (usersyscall_nanosleep(&t,NULL) != 0);
+            total += rdcycle() - start;
+        }
+
+        printf("bench nanosleep:%ld ns,%lu cycles(avg of %d)\r\n",nsec[i],total / BENCH_NANOSLEEP_ROUNDS,BENCH_NANOSLEEP_ROUNDS);
+    }
+
+    bench_check("nanosleep",!failed,"a sleep didn't return 0");
+    t.tv_sec = 0;
+    t.tv_nsec = 1000000000L;
+    bench_check("nanosleep",(usersyscall_nanosleep(&t,NULL) == -1) && (errno == EINVAL),"tv_nsec of a second wasn't EINVAL");
+    bench_check("nanosleep",(usersyscall_nanosleep(NULL,NULL) == -1) && (errno == EFAULT),"a NULL request wasn't EFAULT");
+
+    //a jiffy boundary may fall just after the start,so the sleep spans one jiffy less at least
+    t.tv_nsec = BENCH_NANOSLEEP_TICKS * 10000000L;
+    jiffies = usersyscall_times(NULL);
+    usersyscall_nanosleep(&t,NULL);
+    jiffies = usersyscall_times(NULL) - jiffies;
+    printf("bench nanosleep:%ld ns took %ld jiffies\r\n",t.tv_nsec,jiffies);
+    bench_check("nanosleep",(jiffies >= BENCH_NANOSLEEP_TICKS - 1) && (jiffies <= BENCH_NANOSLEEP_TICKS + BENCH_NANOSLEEP_SLACK),"the sleep was too short or too long");
+    bench_nanosleep_rem();
+
+    memset(&it,0,sizeof(it));
+    it.it_value.tv_sec = 10;
+    it.it_interval.tv_usec = 500000;
+    bench_check("nanosleep",usersyscall_setitimer(ITIMER_REAL,&it,NULL) == 0,"setitimer() failed");
+    t.tv_sec = 0;
+    t.tv_nsec = 2500000L;
+    usersyscall_nanosleep(&t,NULL);
+    memset(&it,0,sizeof(it));
+    bench_check("nanosleep",usersyscall_getitimer(ITIMER_REAL,&it) == 0,"getitimer() failed");
+    printf("bench nanosleep:itimer %ld.%06ld s left,interval %ld.%06ld s\r\n",(long)it.it_value.tv_sec,it.it_value.tv_usec,(long)it.it_interval.tv_sec,it.it_interval.tv_usec);
+    bench_check("nanosleep",(it.it_value.tv_sec == 9) && (it.it_value.tv_usec > 900000L),"the time left of the itimer is wrong");
+    bench_check("nanosleep",(it.it_interval.tv_sec == 0) && (it.it_interval.tv_usec == 500000L),"the itimer interval didn't read back");
+    bench_check("nanosleep",usersyscall_getitimer(ITIMER_VIRTUAL,&it) == -1,"ITIMER_VIRTUAL was accepted");
+    memset(&it,0,sizeof(it));
+    usersyscall_setitimer(ITIMER_REAL,&it,NULL);
+    usersyscall_debug(DEBUG_SHOW_SCHED);
+}
+
+#define BENCH_TIMER_TASKS 16
+#define BENCH_TIMER_ROUNDS 1000
+#define BENCH_TIMER_SLACK 10//jiffies the last alarm may be late by
+
+//The cycles alarm() takes to set and cancel a timer while other tasks sleep on alarms of their own,
+//every alarm has to fire on its jiffy
+static void bench_timer()
+{
+    ulong start,total;
+    int64_t jiffies,left;
+    int i,stat,failed = 0;
+
+    usersyscall_debug(DEBUG_SCHED_RESET);
+    jiffies = usersyscall_times(NULL);
+
+    //SIGALRM ends the children within 3 seconds
+    for(i = 0;i < BENCH_TIMER_TASKS;i++)
+    {
+        if(!usersyscall_fork())
+        {
+            usersyscall_alarm(1 + i % 3);
+            usersyscall_pause();
+            usersyscall_exit(0);
+        }
+    }
+
+    start = rdcycle();
+
+    for(i = 0;i < BENCH_TIMER_ROUNDS;i++)
+    {
+        usersyscall_alarm(100);
+        left = usersyscall_alarm(0);
+        failed |= (left < 99) || (left > 100);
+    }
+
+    total = rdcycle() - start;
+
+    for(i = 0;i < BENCH_TIMER_TASKS;i++)
+    {
+        wait(&stat);
+    }
+
+    jiffies = usersyscall_times(NULL) - jiffies;
+    printf("bench timer:%d tasks on alarms,alarm set and cancel %lu cycles(avg of %d)\r\n",BENCH_TIMER_TASKS,total / BENCH_TIMER_ROUNDS,BENCH_TIMER_ROUNDS);
+    bench_check("timer",!failed,"cancelling an alarm didn't return the seconds left");
+    //the last alarms are 3 seconds out
+    bench_check("timer",(jiffies >= 300 - 1) && (jiffies <= 300 + BENCH_TIMER_SLACK),"the alarms ended too early or too late");
+    usersyscall_debug(DEBUG_SHOW_SCHED);
+}
+
 int main(int argc,char **argv,char **envp)
 {
     char ch[10];
     char ch2[10];
     int i,j;
     
+    //used by "bench spawn"
+    if((argc > 1) && (strcmp(argv[1],"-exit") == 0))
+    {
+        usersyscall_exit(0);
+    }
     
     printf("the first user program for linux 0.11 RISCV Version by LiZhirui 2019.12.17\r\n");
     printf("argc = %d\r\n",argc);
@@ -291,6 +1355,109 @@ int main(int argc,char **argv,char **envp)
         {
             printf("help:\r\n");
             printf("ls [path]\r\n");
+            printf("meminfo\r\n");
+            printf("maps\r\n");
+            printf("ps\r\n");
+            printf("bench swap\r\n");
+            printf("bench tlb\r\n");
+            printf("bench fork\r\n");
+            printf("bench fault\r\n");
+            printf("bench asid\r\n");
+            printf("bench spawn\r\n");
+            printf("bench mmap\r\n");
+            printf("bench zero\r\n");
+            printf("bench mlock\r\n");
+            printf("bench madvise\r\n");
+            printf("bench sched\r\n");
+            printf("bench smp\r\n");
+            printf("bench tick\r\n");
+            printf("bench nanosleep\r\n");
+            printf("bench timer\r\n");
+        }
+        else if(strcmp(buf,"bench swap") == 0)
+        {
+            bench_swap();
+        }
+        else if(strcmp(buf,"bench tlb") == 0)
+        {
+            bench_tlb(0);
+            bench_tlb(1);
+            usersyscall_debug(DEBUG_SHOW_MEM);
+        }
+        else if(strcmp(buf,"bench fork") == 0)
+        {
+            bench_fork(0);
+            bench_fork(1);
+            usersyscall_debug(DEBUG_SHOW_MEM);
+        }
+        else if(strcmp(buf,"bench fault") == 0)
+        {
+            bench_fault();
+        }
+        else if(strcmp(buf,"bench asid") == 0)
+        {
+            bench_asid();
+        }
+        else if(strcmp(buf,"bench spawn") == 0)
+        {
+            bench_spawn(0);
+            bench_spawn(1);
+        }
+        else if(strcmp(buf,"bench mmap") == 0)
+        {
+            bench_mmap("/bin/sh");
+        }
+        else if(strcmp(buf,"bench zero") == 0)
+        {
+            bench_zero();
+        }
+        else if(strcmp(buf,"bench mlock") == 0)
+        {
+            bench_mlock(0);
+            bench_mlock(1);
+        }
+        else if(strcmp(buf,"bench madvise") == 0)
+        {
+            bench_madvise("/bin/sh",MADV_NORMAL);
+            bench_madvise("/bin/sh",MADV_RANDOM);
+            bench_madvise("/bin/sh",MADV_SEQUENTIAL);
+            bench_madvise_check("/bin/sh");
+        }
+        else if(strcmp(buf,"bench sched") == 0)
+        {
+            bench_sched(8);
+            bench_sched(32);
+            bench_sched(64);
+        }
+        else if(strcmp(buf,"bench smp") == 0)
+        {
+            bench_smp();
+        }
+        else if(strcmp(buf,"bench tick") == 0)
+        {
+            bench_tick();
+        }
+        else if(strcmp(buf,"bench nanosleep") == 0)
+        {
+            bench_nanosleep();
+        }
+        else if(strcmp(buf,"bench timer") == 0)
+        {
+            bench_timer();
+        }
+        else if(strcmp(buf,"maps") == 0)
+        {
+            usersyscall_debug(DEBUG_SHOW_VMA);
+        }
+        else if(strcmp(buf,"ps") == 0)
+        {
+            usersyscall_debug(DEBUG_SHOW_TASK);
+        }
+        else if(strcmp(buf,"meminfo") == 0)
+        {
+            usersyscall_debug(DEBUG_SHOW_MEM);
+            usersyscall_debug(DEBUG_SHOW_SWAP);
+            usersyscall_debug(DEBUG_SHOW_SLAB);
         }
         else if(strcmp(buf,"exit") == 0)
         {
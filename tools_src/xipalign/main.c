@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//Lay executables in a minix root image out for execute-in-place.
+//Usage:xipalign rootfs.bin /bin/sh [more paths]
+//Each file is moved to one run of free blocks,so that file block 1,where the a.out text starts after the
+//1KB header,begins a 4KB page of the image.The image is loaded page aligned,so every whole text page
+//can then be mapped from the ramdisk directly.Indirect blocks stay where they are
+
+#define BLOCK_SIZE 1024
+#define PAGE_BLOCKS 4
+#define TEXT_BLOCK 1//file block the text starts at
+#define SUPER_MAGIC 0x137F
+#define ROOT_INO 1
+#define NAME_LEN 14
+#define DIRECT_ZONES 7
+#define ZONES_PER_BLOCK (BLOCK_SIZE / 2)
+
+typedef unsigned char u8;
+typedef unsigned short u16;
+typedef unsigned int u32;
+
+struct super_block
+{
+    u16 s_ninodes;
+    u16 s_nzones;
+    u16 s_imap_blocks;
+    u16 s_zmap_blocks;
+    u16 s_firstdatazone;
+    u16 s_log_zone_size;
+    u32 s_max_size;
+    u16 s_magic;
+};
+
+struct d_inode
+{
+    u16 i_mode;
+    u16 i_uid;
+    u32 i_size;
+    u32 i_time;
+    u8 i_gid;
+    u8 i_nlinks;
+    u16 i_zone[9];
+};
+
+struct dir_entry
+{
+    u16 inode;
+    char name[NAME_LEN];
+};
+
+static u8 *image;
+static long image_size;
+static struct super_block *sb;
+static u8 *zmap;
+
+static u8 *block(u32 nr)
+{
+    if((!nr) || ((long)(nr + 1) * BLOCK_SIZE > image_size))
+    {
+        fprintf(stderr,"xipalign:block %u outside the image\n",nr);
+        exit(1);
+    }
+
+    return image + nr * BLOCK_SIZE;
+}
+
+static struct d_inode *inode(u32 ino)
+{
+    u32 start = 2 + sb -> s_imap_blocks + sb -> s_zmap_blocks;
+
+    ino--;
+    return ((struct d_inode *)block(start + ino / (BLOCK_SIZE / sizeof(struct d_inode)))) + ino % (BLOCK_SIZE / sizeof(struct d_inode));
+}
+
+//bit 0 of the zone map stands for no zone,bit 1 for the first data zone
+static int zone_used(u32 nr)
+{
+    nr -= sb -> s_firstdatazone - 1;
+    return (zmap[nr >> 3] >> (nr & 7)) & 1;
+}
+
+static void zone_set(u32 nr,int used)
+{
+    nr -= sb -> s_firstdatazone - 1;
+
+    if(used)
+    {
+        zmap[nr >> 3] |= 1 << (nr & 7);
+    }
+    else
+    {
+        zmap[nr >> 3] &= ~(1 << (nr & 7));
+    }
+}
+
+//Return the zones listed in the indirect block *slot,taking a free zone for it if it is missing and alloc is set
+static u16 *indirect(u16 *slot,int alloc)
+{
+    u32 z;
+
+    if(!*slot)
+    {
+        if(!alloc)
+        {
+            return NULL;
+        }
+
+        for(z = sb -> s_firstdatazone;(z < sb -> s_nzones) && zone_used(z);z++);
+
+        if(z >= sb -> s_nzones)
+        {
+            fprintf(stderr,"xipalign:no free zone for an indirect block\n");
+            exit(1);
+        }
+
+        zone_set(z,1);
+        memset(block(z),0,BLOCK_SIZE);
+        *slot = (u16)z;
+    }
+
+    return (u16 *)block(*slot);
+}
+
+//Return the address of the zone number of file block nr,NULL if it isn't there
+static u16 *bmap(struct d_inode *ip,u32 nr,int alloc)
+{
+    u16 *ind;
+
+    if(nr < DIRECT_ZONES)
+    {
+        return &ip -> i_zone[nr];
+    }
+
+    nr -= DIRECT_ZONES;
+
+    if(nr < ZONES_PER_BLOCK)
+    {
+        return (ind = indirect(&ip -> i_zone[7],alloc)) ? ind + nr : NULL;
+    }
+
+    nr -= ZONES_PER_BLOCK;
+
+    if((nr >= ZONES_PER_BLOCK * ZONES_PER_BLOCK) || (!(ind = indirect(&ip -> i_zone[8],alloc))) || (!(ind = indirect(&ind[nr / ZONES_PER_BLOCK],alloc))))
+    {
+        return NULL;
+    }
+
+    return ind + nr % ZONES_PER_BLOCK;
+}
+
+static u32 lookup(const char *path)
+{
+    struct d_inode *dir;
+    struct dir_entry *de;
+    const char *end;
+    u32 ino = ROOT_INO;
+    u32 i,j,len;
+    u16 *zone;
+
+    while(*path)
+    {
+        while(*path == '/')
+        {
+            path++;
+        }
+
+        if(!*path)
+        {
+            break;
+        }
+
+        for(end = path;*end && (*end != '/');end++);
+
+        len = (u32)(end - path);
+        dir = inode(ino);
+        ino = 0;
+
+        for(i = 0;(i < (dir -> i_size + BLOCK_SIZE - 1) / BLOCK_SIZE) && (!ino);i++)
+        {
+            if((!(zone = bmap(dir,i,0))) || (!*zone))
+            {
+                continue;
+            }
+
+            de = (struct dir_entry *)block(*zone);
+
+            for(j = 0;j < BLOCK_SIZE / sizeof(struct dir_entry);j++)
+            {
+                if(de[j].inode && (len <= NAME_LEN) && (!strncmp(de[j].name,path,len)) && ((len == NAME_LEN) || (!de[j].name[len])))
+                {
+                    ino = de[j].inode;
+                    break;
+                }
+            }
+        }
+
+        if(!ino)
+        {
+            return 0;
+        }
+
+        path = end;
+    }
+
+    return ino;
+}
+
+static int align_file(const char *path)
+{
+    struct d_inode *ip;
+    u32 ino,blocks,i,start,n;
+    u16 *zone;
+    u8 *data;
+
+    if(!(ino = lookup(path)))
+    {
+        fprintf(stderr,"xipalign:%s not found\n",path);
+        return 1;
+    }
+
+    ip = inode(ino);
+    blocks = (ip -> i_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    if(!blocks)
+    {
+        return 0;
+    }
+
+    if(!(data = calloc(blocks,BLOCK_SIZE)))
+    {
+        fprintf(stderr,"xipalign:out of memory\n");
+        return 1;
+    }
+
+    //take the file's blocks out,they may be part of the new run
+    for(i = 0;i < blocks;i++)
+    {
+        if((zone = bmap(ip,i,0)) && *zone)
+        {
+            memcpy(data + i * BLOCK_SIZE,block(*zone),BLOCK_SIZE);
+            zone_set(*zone,0);
+        }
+    }
+
+    //file block TEXT_BLOCK has to start a page
+    for(start = sb -> s_firstdatazone;start + blocks <= sb -> s_nzones;start++)
+    {
+        if((start + TEXT_BLOCK) % PAGE_BLOCKS)
+        {
+            continue;
+        }
+
+        for(n = 0;(n < blocks) && (!zone_used(start + n));n++);
+
+        if(n == blocks)
+        {
+            break;
+        }
+    }
+
+    if(start + blocks > sb -> s_nzones)
+    {
+        for(i = 0;i < blocks;i++)
+        {
+            if((zone = bmap(ip,i,0)) && *zone)
+            {
+                zone_set(*zone,1);
+            }
+        }
+
+        fprintf(stderr,"xipalign:no aligned run of %u free blocks for %s\n",blocks,path);
+        free(data);
+        return 1;
+    }
+
+    for(i = 0;i < blocks;i++)
+    {
+        zone_set(start + i,1);
+    }
+
+    for(i = 0;i < blocks;i++)
+    {
+        if(!(zone = bmap(ip,i,1)))
+        {
+            fprintf(stderr,"xipalign:%s is too big\n",path);
+            exit(1);
+        }
+
+        *zone = (u16)(start + i);
+        memcpy(block(start + i),data + i * BLOCK_SIZE,BLOCK_SIZE);
+    }
+
+    printf("xipalign:%s %u blocks at %u,text at image offset 0x%x\n",path,blocks,start,(start + TEXT_BLOCK) * BLOCK_SIZE);
+    free(data);
+    return 0;
+}
+
+int main(int argc,char **argv)
+{
+    FILE *fp;
+    int i,err = 0;
+
+    if(argc < 3)
+    {
+        fprintf(stderr,"usage:xipalign image file...\n");
+        return 1;
+    }
+
+    if(!(fp = fopen(argv[1],"rb")))
+    {
+        fprintf(stderr,"xipalign:can't open %s\n",argv[1]);
+        return 1;
+    }
+
+    fseek(fp,0,SEEK_END);
+    image_size = ftell(fp);
+    fseek(fp,0,SEEK_SET);
+
+    if((!(image = malloc(image_size))) || (fread(image,1,image_size,fp) != (size_t)image_size))
+    {
+        fprintf(stderr,"xipalign:can't read %s\n",argv[1]);
+        return 1;
+    }
+
+    fclose(fp);
+    sb = (struct super_block *)block(1);
+
+    if((sb -> s_magic != SUPER_MAGIC) || sb -> s_log_zone_size)
+    {
+        fprintf(stderr,"xipalign:%s isn't a minix image with 14 character names and 1KB zones\n",argv[1]);
+        return 1;
+    }
+
+    zmap = block(2 + sb -> s_imap_blocks);
+
+    for(i = 2;i < argc;i++)
+    {
+        err |= align_file(argv[i]);
+    }
+
+    if(!(fp = fopen(argv[1],"wb")) || (fwrite(image,1,image_size,fp) != (size_t)image_size))
+    {
+        fprintf(stderr,"xipalign:can't write %s\n",argv[1]);
+        return 1;
+    }
+
+    fclose(fp);
+    return err;
+}